@@ -21,6 +21,10 @@
  * Created on February 24, 2015, 9:35 AM
  */
 
+#if defined(__unix__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE /* pthread_rwlock_t with strict C standards */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
@@ -30,6 +34,27 @@
 
 #include "ccronexpr.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CRON_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if !defined(CRON_NO_THREADS) && (defined(__unix__) || defined(__APPLE__))
+#define CRON_USE_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CRON_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define CRON_MAX_SECONDS 60
 #define CRON_MAX_MINUTES 60
 #define CRON_MAX_HOURS 24
@@ -37,6 +62,11 @@
 #define CRON_MAX_DAYS_OF_MONTH 32
 #define CRON_MAX_MONTHS 13
 
+#define CRON_BATCH_MAX_THREADS 256
+#define CRON_BATCH_MIN_CHUNK 256
+/* Bytes of expression lines parsed per thread at least */
+#define CRON_LINES_MIN_CHUNK 16384
+
 
 // Bit 0...11 = Month
 // Bit 13 ... 15 are used for W and L flags
@@ -69,6 +99,15 @@ typedef enum {
 
 #define CRON_CF_ARR_LEN 7 /* or (CRON_CF_YEAR-CRON_CF_SECOND+1) */
 
+/* Values of cron_expr.kind */
+typedef enum {
+    CRON_KIND_GENERAL = 0, /* day constraints, searched field by field */
+    CRON_KIND_PERIOD, /* every day, fire times every 'period' seconds from 'offset' on (a fixed time of day if the period is a day) */
+    CRON_KIND_EVERY_DAY, /* every day, any time of day fields */
+    CRON_KIND_SPARSE, /* day constraints, searched from the top down: month, day, then time of day */
+    CRON_KIND_NEVER /* no date of a full 400-year cycle matches, never fires */
+} cron_kind;
+
 #define CRON_INVALID_INSTANT ((time_t) -1)
 
 static const char *DAYS_ARR[] = {"SUN", "MON", "TUE", "WED", "THU", "FRI", "SAT"};
@@ -78,17 +117,52 @@ static const char *MONTHS_ARR[] = {"FOO", "JAN", "FEB", "MAR", "APR", "MAY", "JU
 #define CRON_MONTHS_ARR_LEN 13
 
 #define CRON_MAX_STR_LEN_TO_SPLIT 256
-#define CRON_MAX_NUM_TO_SRING 1000000000
-/* computes number of digits in decimal number */
-#define CRON_NUM_OF_DIGITS(num) (abs(num) < 10 ? 1 : \
-                                (abs(num) < 100 ? 2 : \
-                                (abs(num) < 1000 ? 3 : \
-                                (abs(num) < 10000 ? 4 : \
-                                (abs(num) < 100000 ? 5 : \
-                                (abs(num) < 1000000 ? 6 : \
-                                (abs(num) < 10000000 ? 7 : \
-                                (abs(num) < 100000000 ? 8 : \
-                                (abs(num) < 1000000000 ? 9 : 10)))))))))
+
+#ifndef CRON_TEST_MALLOC
+#define cronFree(x) free(x)
+#define cronMalloc(x) malloc(x)
+#else
+
+void *cronMalloc(size_t n);
+
+void cronFree(void *p);
+
+#endif
+
+static void *cron_default_alloc(void *ctx, size_t size) {
+    (void) ctx;
+    return cronMalloc(size);
+}
+
+static void cron_default_free(void *ctx, void *ptr) {
+    (void) ctx;
+    cronFree(ptr);
+}
+
+static cron_allocator cron_current_allocator = {cron_default_alloc, cron_default_free, NULL};
+
+void cron_set_allocator(const cron_allocator *allocator) {
+    if (allocator && allocator->alloc_fn && allocator->free_fn) {
+        cron_current_allocator = *allocator;
+    } else {
+        cron_current_allocator.alloc_fn = cron_default_alloc;
+        cron_current_allocator.free_fn = cron_default_free;
+        cron_current_allocator.ctx = NULL;
+    }
+}
+
+/** Allocator of a call, the current one if the caller doesn't pass any */
+static const cron_allocator *call_allocator(const cron_allocator *allocator) {
+    return allocator && allocator->alloc_fn && allocator->free_fn ? allocator : &cron_current_allocator;
+}
+
+static void *cron_alloc(const cron_allocator *allocator, size_t size) {
+    return allocator->alloc_fn(allocator->ctx, size);
+}
+
+static void cron_free(const cron_allocator *allocator, void *ptr) {
+    if (ptr) allocator->free_fn(allocator->ctx, ptr);
+}
 
 #ifndef _WIN32
 
@@ -130,17 +204,6 @@ time_t cron_mktime(struct tm *tm) {
 #endif /* _WIN32 */
 
 
-#ifndef CRON_TEST_MALLOC
-#define cronFree(x) free(x)
-#define cronMalloc(x) malloc(x)
-#else
-
-void *cronMalloc(size_t n);
-
-void cronFree(void *p);
-
-#endif
-
 struct tm *cron_time(time_t *date, struct tm *out) {
 #ifdef __MINGW32__
     (void)(out); /* To avoid unused warning */
@@ -171,40 +234,102 @@ struct tm* cron_time(time_t* date, struct tm* out) {
 
 #endif /* CRON_USE_LOCAL_TIME */
 
-static void free_splitted(char **splitted, size_t len) {
-    size_t i;
-    if (!splitted) return;
-    for (i = 0; i < len; i++) {
-        if (splitted[i]) {
-            cronFree(splitted[i]);
+/**
+ * Count trailing zeros of a non-zero word.
+ */
+static unsigned int count_trailing_zeros(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int) __builtin_ctzll(word);
+#else
+    /* de Bruijn multiplication, isolating the lowest set bit first */
+    static const uint8_t DE_BRUIJN_POS[64] = {
+            0, 1, 2, 53, 3, 7, 54, 27, 4, 38, 41, 8, 34, 55, 48, 28,
+            62, 5, 39, 46, 44, 42, 22, 9, 24, 35, 59, 56, 49, 18, 29, 11,
+            63, 52, 6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+            51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12};
+    return DE_BRUIJN_POS[((word & (~word + 1)) * UINT64_C(0x022fdd63cc95386d)) >> 58];
+#endif
+}
+
+/**
+ * Position of the highest set bit of a non-zero word.
+ */
+static unsigned int highest_set_bit(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - (unsigned int) __builtin_clzll(word);
+#else
+    unsigned int pos = 0;
+    unsigned int shift;
+    for (shift = 32; shift; shift >>= 1) {
+        if (word >> shift) {
+            word >>= shift;
+            pos += shift;
         }
     }
-    cronFree(splitted);
+    return pos;
+#endif
 }
 
-static char *strdupl(const char *str, size_t len) {
-    if (!str) return NULL;
-    char *res = (char *) cronMalloc(len + 1);
-    if (!res) return NULL;
-    memset(res, 0, len + 1);
-    memcpy(res, str, len);
-    return res;
+/** Number of set bits in word */
+static unsigned int count_set_bits(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int) __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & UINT64_C(0x5555555555555555));
+    word = (word & UINT64_C(0x3333333333333333)) + ((word >> 2) & UINT64_C(0x3333333333333333));
+    word = (word + (word >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return (unsigned int) ((word * UINT64_C(0x0101010101010101)) >> 56);
+#endif
+}
+
+/**
+ * Load the bits [0:max[ of a cron_expr field into one word, bit i of the word being cron_getBit(bits, i).
+ * Only the ceil(max / 8) bytes holding these bits are read; max must not exceed 64.
+ */
+static uint64_t load_bits(const uint8_t *bits, unsigned int max) {
+    uint64_t word = 0;
+    unsigned int i = (max + 7) / 8;
+    while (i--) {
+        word = (word << 8) | bits[i];
+    }
+    return max < 64 ? word & ((UINT64_C(1) << max) - 1) : word;
 }
 
 /** Return next set bit position of bits starting at from_index as integer, set notfound to 1 if none was found.
  *  Interval: [from_index:max[
  */
 static unsigned int next_set_bit(const uint8_t *bits, unsigned int max, unsigned int from_index, int *notfound) {
-    unsigned int i;
-    if (!bits) {
+    uint64_t word;
+    if (!bits || from_index >= max) {
         *notfound = 1;
         return 0;
     }
-    for (i = from_index; i < max; i++) {
-        if (cron_getBit(bits, i)) return i;
+    word = load_bits(bits, max) >> from_index;
+    if (!word) {
+        *notfound = 1;
+        return 0;
     }
-    *notfound = 1;
-    return 0;
+    return from_index + count_trailing_zeros(word);
+}
+
+/** Return previous set bit position of bits starting at from_index (downwards) as integer, set notfound to 1 if none was found.
+ *  Interval: [0:from_index]
+ */
+static unsigned int prev_set_bit(const uint8_t *bits, unsigned int max, unsigned int from_index, int *notfound) {
+    uint64_t word;
+    if (!bits || 0 == max) {
+        *notfound = 1;
+        return 0;
+    }
+    word = load_bits(bits, max);
+    if (from_index < 63) {
+        word &= (UINT64_C(2) << from_index) - 1;
+    }
+    if (!word) {
+        *notfound = 1;
+        return 0;
+    }
+    return highest_set_bit(word);
 }
 
 /// Clear bit in reset byte at position *fi* (*arr* is usually initialized with -1)
@@ -220,6 +345,46 @@ static void push_to_fields_arr(uint8_t *arr, cron_cf fi) {
     *arr &= ~(1 << fi); // Unset bit at position fi
 }
 
+/** L flags for DOM and DOW, or W flag for DOM of expr: Bit 0: W (day of month), Bit 1: L (day of month), Bit 2: L (day of week) */
+static uint8_t get_lw_flags(const cron_expr *expr) {
+    uint8_t lw_flags = 0;
+    if (cron_getBit(expr->months, CRON_L_DOM_BIT)) {
+        lw_flags |= L_DOM_FLAG;
+    }
+    if (cron_getBit(expr->months, CRON_L_DOW_BIT)) {
+        lw_flags |= L_DOW_FLAG;
+    }
+    if (cron_getBit(expr->months, CRON_W_DOM_BIT)) {
+        lw_flags |= W_DOM_FLAG;
+    }
+    return lw_flags;
+}
+
+static unsigned int days_in_month(int64_t y, unsigned int m) {
+    static const uint8_t DAYS_IN_MONTH[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    if (2 == m && 0 == y % 4 && (0 != y % 100 || 0 == y % 400)) {
+        return 29;
+    }
+    return DAYS_IN_MONTH[m - 1];
+}
+
+/**
+ * Days of a month falling on the days of week of an expression, as bits 1-31 of a mask: the days of week
+ * are rotated by the weekday of the first day, then repeated for the 5 weeks of a month.
+ *
+ * @param days_of_week days of week field of a cron expression
+ * @param first_wday day of week (0 = Sunday) of the first day of the month
+ * @param lastday last day of the month
+ */
+static uint32_t month_weekdays(const uint8_t *days_of_week, unsigned int first_wday, unsigned int lastday) {
+    uint64_t week = load_bits(days_of_week, 7);
+    week = ((week >> first_wday) | (week << (7 - first_wday))) & 0x7F;
+    week *= UINT64_C(0x10204081);
+    return (uint32_t) ((week << 1) & ((UINT64_C(2) << lastday) - 2));
+}
+
+#ifdef CRON_USE_LOCAL_TIME
+
 static int add_to_field(struct tm *calendar, cron_cf field, int val) {
     if (!calendar) {
         return 1;
@@ -613,8 +778,9 @@ find_next_day(struct tm *calendar, const uint8_t *cron_dom, unsigned int day_of_
               unsigned int day_of_week, const uint8_t lw_flags, const uint8_t *l_dom_offset, const uint8_t *l_dow_flags,
               const uint8_t *w_flags, uint8_t *reset_fields, int *res_out) {
     int err;
-    unsigned int count = 0;
-    int max_days = 366; // without flags, advance 1 year may. days until months end with lw_flags; then the L- and W-Flags need to be recalculated
+    unsigned int lastday;
+    unsigned int first_wday;
+    uint32_t days;
     // Copy cron_dom to add days determined by L- and W- flags
     uint8_t cur_doms[4];
     memcpy(cur_doms, cron_dom, 4);
@@ -634,27 +800,29 @@ find_next_day(struct tm *calendar, const uint8_t *cron_dom, unsigned int day_of_
             // something went wrong; keep res_out value, return 0
             return 0;
         }
-        // Get last day of current month: 0th day of next month
-        searcher.tm_mday = 0;
-        searcher.tm_mon += 1;
-        time_t check = cron_mktime(&searcher);
-        if (CRON_INVALID_INSTANT == check) {
-            *res_out = 1;
-            return 0;
-        }
-        max_days = (searcher.tm_mday - calendar->tm_mday) + 1; // 1 day more, to allow rolling over into next month
     }
-    // Find next fitting day in month, or reset lower fields and roll over into next month
-    while ( (!cron_getBit(cur_doms, day_of_month) || !cron_getBit(cron_dow, day_of_week)) &&
-           count++ < max_days) {
-        err = add_to_field(calendar, CRON_CF_DAY_OF_MONTH, 1);
-
-        if (err) goto return_error;
-        day_of_month = calendar->tm_mday;
-        day_of_week = calendar->tm_wday;
-        reset_all(calendar, reset_fields);
+    // Days of the rest of the month matching both fields, with one bit scan instead of stepping day by day
+    lastday = days_in_month((int64_t) calendar->tm_year + 1900, (unsigned int) calendar->tm_mon + 1);
+    first_wday = (day_of_week + 35 - (day_of_month - 1)) % 7;
+    days = (uint32_t) load_bits(cur_doms, CRON_MAX_DAYS_OF_MONTH) & month_weekdays(cron_dow, first_wday, lastday);
+    days = days >> day_of_month << day_of_month;
+    // Jumps may cross a daylight saving time change, let mktime() determine it for the target day
+    if (days) {
+        if (count_trailing_zeros(days) != day_of_month) {
+            calendar->tm_isdst = -1;
+            err = set_field(calendar, CRON_CF_DAY_OF_MONTH, count_trailing_zeros(days));
+            if (err) goto return_error;
+            reset_all(calendar, reset_fields);
+        }
+        return (unsigned int) calendar->tm_mday;
     }
-    return day_of_month;
+    // No matching day left, roll over into the next month in one step
+    calendar->tm_mday = 1;
+    calendar->tm_isdst = -1;
+    err = add_to_field(calendar, CRON_CF_MONTH, 1);
+    if (err) goto return_error;
+    reset_all(calendar, reset_fields);
+    return (unsigned int) calendar->tm_mday;
 
     return_error:
     *res_out = 1;
@@ -765,1027 +933,3644 @@ static int do_next(const cron_expr *expr, struct tm *calendar, unsigned int dot)
     return res;
 }
 
-static int to_upper(char *str) {
-    if (!str) return 1;
-    int i;
-    for (i = 0; '\0' != str[i]; i++) {
-        str[i] = (char) toupper(str[i]);
-    }
-    return 0;
-}
+#endif /* CRON_USE_LOCAL_TIME */
 
-static char *to_string(int num) {
-    if (abs(num) >= CRON_MAX_NUM_TO_SRING) return NULL;
-    char *str = (char *) cronMalloc(CRON_NUM_OF_DIGITS(num) + 1);
-    if (!str) return NULL;
-    int res = sprintf(str, "%d", num);
-    if (res < 0) return NULL;
-    return str;
+/*
+ * Civil-time evaluation engine
+ *
+ * The search state is a day counter (days since 1970-01-01) plus the second of that day. Calendar fields are
+ * derived from it with the closed-form days-from-civil/civil-from-days conversions described in
+ * http://howardhinnant.github.io/date_algorithms.html, so no call to timegm/gmtime_r is needed between entering
+ * and leaving cron_next(). The search itself follows do_next() step by step.
+ *
+ * With CRON_USE_LOCAL_TIME the calendar holds local wall-clock time; it is only converted from and to time_t
+ * at entry and exit.
+ */
+
+#define CRON_SECONDS_PER_DAY 86400
+/* The gregorian calendar repeats every 400 years (146097 days, a whole number of weeks): the days matching an
+ * expression do too, so an expression without a matching day in as many months never fires */
+#define CRON_CYCLE_MONTHS (400 * 12)
+/* Days since 1970-01-01 of the 1st of January of the years INT_MIN and INT_MAX + 1: the calendar year is an int, as
+ * in struct tm, so the civil dates lie in between */
+#define CRON_CIVIL_MIN_DAYS INT64_C(-784353015833)
+#define CRON_CIVIL_END_DAYS INT64_C(784351576777)
+
+typedef struct {
+    int64_t days; /* days since 1970-01-01 */
+    int sod; /* second of day, 0-86399 */
+    int year; /* gregorian year, e.g. 2012 */
+    int mon; /* month of year, 0-11 */
+    int mday; /* day of month, 1-31 */
+    int wday; /* day of week, 0-6 with 0 = Sunday */
+    int overflow; /* set if days fell out of the years of an int, the fields above are invalid then */
+} cron_civil;
+
+/** Days since 1970-01-01 of the gregorian date y-m-d, with m from 1 to 12. d may exceed the days of the month. */
+static int64_t days_from_civil(int64_t y, unsigned int m, unsigned int d) {
+    int64_t era;
+    unsigned int yoe, doy, doe;
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (unsigned int) (y - era * 400);
+    doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int64_t) doe - 719468;
 }
 
-static char *str_replace(char *orig, const char *rep, const char *with) {
-    char *result; /* the return string */
-    char *ins; /* the next insert point */
-    char *tmp; /* varies */
-    size_t len_rep; /* length of rep */
-    size_t len_with; /* length of with */
-    size_t len_front; /* distance between rep and end of last rep */
-    int count; /* number of replacements */
-    if (!orig) return NULL;
-    if (!rep) rep = "";
-    if (!with) with = "";
-    len_rep = strlen(rep);
-    len_with = strlen(with);
-
-    ins = orig;
-    for (count = 0; NULL != (tmp = strstr(ins, rep)); ++count) {
-        ins = tmp + len_rep;
-    }
-
-    /* first time through the loop, all the variable are set correctly
-     from here on,
-     tmp points to the end of the result string
-     ins points to the next occurrence of rep in orig
-     orig points to the remainder of orig after "end of rep"
-     */
-    tmp = result = (char *) cronMalloc(strlen(orig) + (len_with - len_rep) * count + 1);
-    if (!result) return NULL;
+/** Gregorian date of the day *days* since 1970-01-01, with *m from 1 to 12. */
+static void civil_from_days(int64_t days, int64_t *y, unsigned int *m, unsigned int *d) {
+    int64_t era;
+    unsigned int doe, yoe, doy, mp;
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = (unsigned int) (days - era * 146097);
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = (int64_t) yoe + era * 400 + (*m <= 2);
+}
 
-    while (count--) {
-        ins = strstr(orig, rep);
-        len_front = ins - orig;
-        tmp = strncpy(tmp, orig, len_front) + len_front;
-        tmp = strcpy(tmp, with) + len_with;
-        orig += len_front + len_rep; /* move to next "end of rep" */
-    }
-    strcpy(tmp, orig);
-    return result;
+/** Day of week (0 = Sunday) of the day *days* since 1970-01-01, which was a Thursday. */
+static int weekday_from_days(int64_t days) {
+    return (int) (days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6);
 }
 
-static unsigned int parse_uint(const char *str, int *errcode) {
-    char *endptr;
-    errno = 0;
-    long int l = strtol(str, &endptr, 10);
-    if (errno == ERANGE || *endptr != '\0' || l < 0 || l > INT_MAX) {
-        *errcode = 1;
-        return 0;
-    } else {
-        *errcode = 0;
-        return (unsigned int) l;
+static void civil_set_days(cron_civil *calendar, int64_t days) {
+    int64_t y;
+    unsigned int m, d;
+    civil_from_days(days, &y, &m, &d);
+    if (days < CRON_CIVIL_MIN_DAYS || days >= CRON_CIVIL_END_DAYS) {
+        calendar->overflow = 1;
+        y = days < 0 ? INT_MIN : INT_MAX;
     }
+    calendar->days = days;
+    calendar->year = (int) y;
+    calendar->mon = (int) m - 1;
+    calendar->mday = (int) d;
+    calendar->wday = weekday_from_days(days);
 }
 
-static char **split_str(const char *str, char del, size_t *len_out) {
-    size_t i;
-    size_t stlen = 0;
-    size_t len = 0;
-    int accum = 0;
-    char *buf = NULL;
-    char **res = NULL;
-    size_t bi = 0;
-    size_t ri = 0;
-    char *tmp;
-
-    if (!str) goto return_error;
-    for (i = 0; '\0' != str[i]; i++) {
-        stlen += 1;
-        if (stlen >= CRON_MAX_STR_LEN_TO_SPLIT) goto return_error;
-    }
-
-    for (i = 0; i < stlen; i++) {
-        if (del == str[i]) {
-            if (accum > 0) {
-                len += 1;
-                accum = 0;
-            }
-        } else if (!isspace(str[i])) {
-            accum += 1;
-        }
-    }
-    /* tail */
-    if (accum > 0) {
-        len += 1;
-    }
-    if (0 == len) return NULL;
-
-    buf = (char *) cronMalloc(stlen + 1);
-    if (!buf) goto return_error;
-    memset(buf, 0, stlen + 1);
-    res = (char **) cronMalloc(len * sizeof(char *));
-    if (!res) goto return_error;
-
-    for (i = 0; i < stlen; i++) {
-        if (del == str[i]) {
-            if (bi > 0) {
-                tmp = strdupl(buf, bi);
-                if (!tmp) goto return_error;
-                res[ri++] = tmp;
-                memset(buf, 0, stlen + 1);
-                bi = 0;
-            }
-        } else if (!isspace(str[i])) {
-            buf[bi++] = str[i];
-        }
+/** Set the second of day, carrying whole days over into the day counter. */
+static void civil_set_sod(cron_civil *calendar, int64_t sod) {
+    int64_t carry = sod / CRON_SECONDS_PER_DAY;
+    sod %= CRON_SECONDS_PER_DAY;
+    if (sod < 0) {
+        sod += CRON_SECONDS_PER_DAY;
+        carry--;
     }
-    /* tail */
-    if (bi > 0) {
-        tmp = strdupl(buf, bi);
-        if (!tmp) goto return_error;
-        res[ri++] = tmp;
+    calendar->sod = (int) sod;
+    if (carry) {
+        civil_set_days(calendar, calendar->days + carry);
     }
-    cronFree(buf);
-    *len_out = len;
-    return res;
+}
 
-    return_error:
-    if (buf) {
-        cronFree(buf);
+/** Set the date, normalizing month and day of month the same way timegm() does (e.g. 31st of February -> 3rd of March). */
+static void civil_set_date(cron_civil *calendar, int64_t year, int64_t mon, int64_t mday) {
+    int64_t carry = mon / 12;
+    mon %= 12;
+    if (mon < 0) {
+        mon += 12;
+        carry--;
     }
-    free_splitted(res, len);
-    *len_out = 0;
-    return NULL;
+    civil_set_days(calendar, days_from_civil(year + carry, (unsigned int) mon + 1, 1) + mday - 1);
 }
 
-static char *replace_ordinals(char *value, const char **arr, size_t arr_len) {
-    size_t i;
-    char *cur = value;
-    char *res = NULL;
-    int first = 1;
-    for (i = 0; i < arr_len; i++) {
-        char *strnum = to_string((int) i);
-        if (!strnum) {
-            if (!first) {
-                cronFree(cur);
-            }
-            return NULL;
-        }
-        res = str_replace(cur, arr[i], strnum);
-        cronFree(strnum);
-        if (!first) {
-            cronFree(cur);
-        }
-        if (!res) {
-            return NULL;
-        }
-        cur = res;
-        if (first) {
-            first = 0;
-        }
-    }
-    return res;
+/** Set the date to the day of month of calendar in year and month mon (0-11), or the last day of that month if it is shorter. */
+static void civil_set_month(cron_civil *calendar, int64_t year, unsigned int mon) {
+    unsigned int lastday = days_in_month(year, mon + 1);
+    unsigned int mday = (unsigned int) calendar->mday;
+    civil_set_days(calendar, days_from_civil(year, mon + 1, mday < lastday ? mday : lastday));
 }
 
-static int has_char(char *str, char ch) {
-    size_t i;
-    size_t len = 0;
-    if (!str) return 0;
-    len = strlen(str);
-    for (i = 0; i < len; i++) {
-        if (str[i] == ch) return 1;
+/** Set the calendar to the seconds since 1970-01-01 00:00:00 of a timeline without offset changes */
+static void civil_set_seconds(cron_civil *calendar, int64_t seconds) {
+    int64_t days = seconds / CRON_SECONDS_PER_DAY;
+    int64_t sod = seconds % CRON_SECONDS_PER_DAY;
+    if (sod < 0) {
+        sod += CRON_SECONDS_PER_DAY;
+        days--;
     }
-    return 0;
+    calendar->sod = (int) sod;
+    calendar->overflow = 0;
+    civil_set_days(calendar, days);
 }
 
-static int hash_seed = 0;
-static cron_custom_hash_fn fn = NULL;
-
-void cron_init_hash(int seed) {
-    hash_seed = seed;
+/** Check if the seconds since 1970-01-01 00:00:00 fall into the years a cron_civil can hold */
+static int civil_in_range(int64_t seconds) {
+    return seconds >= CRON_CIVIL_MIN_DAYS * CRON_SECONDS_PER_DAY &&
+           seconds < CRON_CIVIL_END_DAYS * CRON_SECONDS_PER_DAY;
 }
 
-void cron_init_custom_hash_fn(cron_custom_hash_fn func) {
-    fn = func;
+/** Counterpart of civil_set_seconds(), for calendars within civil_in_range() give or take a search, which can't
+ * overflow */
+static int64_t civil_seconds(const cron_civil *calendar) {
+    return calendar->days * CRON_SECONDS_PER_DAY + calendar->sod;
 }
 
-/**
- * Replace H parameter with integer in proper range. If using an iterator field, min/max have to be set to proper values before!
- * The input field will always be freed, the returned char* should be used instead.
- *
- * @param field CRON field which needs a value for its 'H' (in string form)
- * @param n Position of the field in the CRON string, from 0 - 5
- * @param min Minimum value allowed in field/for replacement
- * @param max Maximum value allowed in field/for replacement
- * @param hashFn Custom random output function, if provided, will be used instead of rand(). Needs to return an integer and needs to accept the seed and index for deterministic behaviour for each field. Can be NULL.
- * @param error Error string in which error descriptions will be stored, if they happen. Just needs to be a const char** pointer. (See usage of get_range)
- * @return New char* with replaced H, to be used instead of field.
- */
-static char *replace_hashed(char *field, unsigned int n, unsigned int min, unsigned int max, cron_custom_hash_fn hashFn,
-                            const char **error) {
-    unsigned int i = 0;
-    unsigned int value;
-    char *newField = NULL;
-    // needed when a custom range is detected and removed
-    char customRemover[8];
-    char innerString[6];
-    char *oldField = field;
-
-    if (!has_char(field, 'H')) {
-        *error = "No H to replace in field";
-        return field;
-    }
-
-    // Generate random value
-    if (hashFn) {
-        value = hashFn(hash_seed, n);
-    } else {
-        int newSeed = rand();
-        srand(hash_seed);
-        while (n >= i++) {
-            value = rand();
-        }
-        srand(newSeed);
+#ifndef CRON_USE_LOCAL_TIME
+
+static int civil_init(cron_civil *calendar, time_t date) {
+    if (!civil_in_range((int64_t) date)) {
+        return 1;
     }
-    // ensure value is below max...
-    value %= max - min;
-    // and above min
-    value += min;
+    civil_set_seconds(calendar, (int64_t) date);
+    return 0;
+}
 
-    // Check if a custom range is present, and get rid of it
-    if (has_char(field, '(')) {
-        sscanf(field, "H(%5[-0123456789])", innerString);
-        sprintf(customRemover, "(%s)", innerString);
-        field = str_replace(field, customRemover, NULL);
-        cronFree(oldField);
+static time_t civil_to_time(const cron_civil *calendar) {
+    int64_t res = civil_seconds(calendar);
+    if (calendar->overflow || (int64_t) (time_t) res != res) {
+        return CRON_INVALID_INSTANT;
     }
+    return (time_t) res;
+}
 
-    // Create string
-    char value_str[3];
-    sprintf(value_str, "%u", value);
-    newField = str_replace(field, "H", value_str);
+#else /* CRON_USE_LOCAL_TIME */
 
-    if (!newField) {
-        *error = "Error allocating newField";
-        return field;
-    }
+/* Snapshot of the process time zone taken by cron_local_zone_refresh(), NULL to use localtime_r()/mktime() */
+static cron_zone *local_zone = NULL;
 
-    cronFree(field);
-    return newField;
-}
+static int32_t zone_offset_at(const cron_zone *zone, int64_t t);
 
-static unsigned int *get_range(char *field, unsigned int min, unsigned int max, const char **error) {
-    char **parts = NULL;
-    size_t len = 0;
-    unsigned int *res = (unsigned int *) cronMalloc(2 * sizeof(unsigned int));
-    if (!res) goto return_error;
-
-    res[0] = 0;
-    res[1] = 0;
-    if (1 == strlen(field) && '*' == field[0]) {
-        res[0] = min;
-        res[1] = max - 1;
-    } else if (!has_char(field, '-')) {
-        int err = 0;
-        unsigned int val = parse_uint(field, &err);
-        if (err) {
-            *error = "Unsigned integer parse error 1";
-            goto return_error;
-        }
+static int64_t zone_local_to_utc(const cron_zone *zone, int64_t local);
 
-        res[0] = val;
-        res[1] = val;
-    } else {
-        parts = split_str(field, '-', &len);
-        if (len != 2) {
-            *error = "Specified range doesn't have two fields";
-            goto return_error;
-        }
-        int err = 0;
-        res[0] = parse_uint(parts[0], &err);
-        if (err) {
-            *error = "Unsigned integer parse error 2";
-            goto return_error;
-        }
-        res[1] = parse_uint(parts[1], &err);
-        if (err) {
-            *error = "Unsigned integer parse error 3";
-            goto return_error;
+static int zone_transition_match(const cron_expr *expr, const cron_zone *zone, int64_t t);
+
+static int civil_init(cron_civil *calendar, time_t date) {
+    struct tm calval;
+    if (local_zone) {
+        if (!civil_in_range((int64_t) date)) {
+            return 1;
         }
+        civil_set_seconds(calendar, (int64_t) date + zone_offset_at(local_zone, date));
+        return calendar->overflow;
     }
-    if (res[0] >= max || res[1] >= max) {
-        *error = "Specified range exceeds maximum";
-        goto return_error;
-    }
-    if (res[0] < min || res[1] < min) {
-        *error = "Specified range is less than minimum";
-        goto return_error;
+    memset(&calval, 0, sizeof(struct tm));
+    if (!cron_time(&date, &calval)) {
+        return 1;
     }
+    calendar->sod = calval.tm_hour * 3600 + calval.tm_min * 60 + calval.tm_sec;
+    calendar->overflow = 0;
+    civil_set_days(calendar, days_from_civil((int64_t) calval.tm_year + 1900, calval.tm_mon + 1, calval.tm_mday));
+    return calendar->overflow;
+}
 
-    free_splitted(parts, len);
-    *error = NULL;
-    return res;
-
-    return_error:
-    free_splitted(parts, len);
-    if (res) {
-        cronFree(res);
+static time_t civil_to_time(const cron_civil *calendar) {
+    struct tm calval;
+    if (calendar->overflow || calendar->year < INT_MIN + 1900) {
+        return CRON_INVALID_INSTANT;
     }
-
-    return NULL;
+    if (local_zone) {
+        int64_t res = zone_local_to_utc(local_zone, civil_seconds(calendar));
+        return (int64_t) (time_t) res == res ? (time_t) res : CRON_INVALID_INSTANT;
+    }
+    memset(&calval, 0, sizeof(struct tm));
+    calval.tm_year = calendar->year - 1900;
+    calval.tm_mon = calendar->mon;
+    calval.tm_mday = calendar->mday;
+    calval.tm_hour = calendar->sod / 3600;
+    calval.tm_min = calendar->sod / 60 % 60;
+    calval.tm_sec = calendar->sod % 60;
+    calval.tm_isdst = -1;
+    return cron_mktime(&calval);
 }
 
-void cron_setBit(uint8_t *rbyte, unsigned int idx) {
-    uint8_t j = idx / 8;
-    uint8_t k = idx % 8;
-
-    rbyte[j] |= (1 << k);
+/** Earliest instant after date with the wall-clock time of calendar, without a zone snapshot; the latest one if
+ * none is after date. mktime() resolves a repeated wall-clock time with the offset of its previous call, so both
+ * are converted explicitly; a skipped one is moved past the transition. */
+static time_t civil_to_time_after(const cron_civil *calendar, time_t date) {
+    struct tm calval;
+    time_t found = CRON_INVALID_INSTANT;
+    time_t shifted = CRON_INVALID_INSTANT;
+    int found_any = 0, shifted_any = 0;
+    int isdst;
+    if (calendar->overflow || calendar->year < INT_MIN + 1900) {
+        return CRON_INVALID_INSTANT;
+    }
+    for (isdst = 1; isdst >= 0; isdst--) {
+        time_t res;
+        memset(&calval, 0, sizeof(struct tm));
+        calval.tm_year = calendar->year - 1900;
+        calval.tm_mon = calendar->mon;
+        calval.tm_mday = calendar->mday;
+        calval.tm_hour = calendar->sod / 3600;
+        calval.tm_min = calendar->sod / 60 % 60;
+        calval.tm_sec = calendar->sod % 60;
+        calval.tm_isdst = isdst;
+        res = cron_mktime(&calval);
+        if (calval.tm_year != calendar->year - 1900 || calval.tm_mon != calendar->mon ||
+            calval.tm_mday != calendar->mday || calval.tm_hour * 3600 + calval.tm_min * 60 + calval.tm_sec !=
+                                                  calendar->sod) {
+            /* Read with the offset of the other side of the transition */
+            if (!shifted_any || res > shifted) shifted = res;
+            shifted_any = 1;
+            continue;
+        }
+        if (!found_any || (found <= date ? res > found : res > date && res < found)) found = res;
+        found_any = 1;
+    }
+    return found_any ? found : shifted;
 }
 
-void cron_delBit(uint8_t *rbyte, unsigned int idx) {
-    uint8_t j = idx / 8;
-    uint8_t k = idx % 8;
+#endif /* CRON_USE_LOCAL_TIME */
 
-    rbyte[j] &= ~(1 << k);
+static unsigned int civil_get(const cron_civil *calendar, cron_cf field) {
+    switch (field) {
+        case CRON_CF_SECOND:
+            return calendar->sod % 60;
+        case CRON_CF_MINUTE:
+            return calendar->sod / 60 % 60;
+        case CRON_CF_HOUR_OF_DAY:
+            return calendar->sod / 3600;
+        case CRON_CF_DAY_OF_WEEK:
+            return calendar->wday;
+        case CRON_CF_DAY_OF_MONTH:
+            return calendar->mday;
+        case CRON_CF_MONTH:
+            return calendar->mon;
+        case CRON_CF_YEAR:
+            return calendar->year - 1900;
+        default:
+            return 0;
+    }
 }
 
-uint8_t cron_getBit(const uint8_t *rbyte, unsigned int idx) {
-    uint8_t j = idx / 8;
-    uint8_t k = idx % 8;
-
-    if (rbyte[j] & (1 << k)) {
-        return 1;
-    } else {
-        return 0;
+/** Counterpart of add_to_field() */
+static void civil_add(cron_civil *calendar, cron_cf field, int val) {
+    switch (field) {
+        case CRON_CF_SECOND:
+            civil_set_sod(calendar, (int64_t) calendar->sod + val);
+            break;
+        case CRON_CF_MINUTE:
+            civil_set_sod(calendar, (int64_t) calendar->sod + (int64_t) val * 60);
+            break;
+        case CRON_CF_HOUR_OF_DAY:
+            civil_set_sod(calendar, (int64_t) calendar->sod + (int64_t) val * 3600);
+            break;
+        case CRON_CF_DAY_OF_WEEK: /* like in add_to_field(), the day of week follows the day of month */
+        case CRON_CF_DAY_OF_MONTH:
+            civil_set_days(calendar, calendar->days + val);
+            break;
+        case CRON_CF_MONTH:
+            civil_set_date(calendar, calendar->year, (int64_t) calendar->mon + val, calendar->mday);
+            break;
+        case CRON_CF_YEAR:
+            civil_set_date(calendar, (int64_t) calendar->year + val, calendar->mon, calendar->mday);
+            break;
+        default:
+            break;
     }
 }
 
-/**
- * Set bits in cron_expr field target, depending on value, and only in the range of [min:max[
- *
- * @param value String of field which needs to be parsed into set bits in cron_expr
- * @param target cron_expr field looking to be filled
- * @param min Min possible value for current field
- * @param max Max possible value for current field, not included in interval
- * @param error String output of error, if one occurred
- */
-void set_number_hits(const char *value, uint8_t *target, unsigned int min, unsigned int max, const char **error) {
-    size_t i;
-    unsigned int i1;
-    size_t len = 0;
+/** Counterpart of set_field(); setting the day of week has no effect, as for timegm(). */
+static void civil_set(cron_civil *calendar, cron_cf field, unsigned int val) {
+    switch (field) {
+        case CRON_CF_SECOND:
+        case CRON_CF_MINUTE:
+        case CRON_CF_HOUR_OF_DAY: {
+            static const int FACTOR[] = {1, 60, 3600};
+            int old = (int) civil_get(calendar, field);
+            civil_set_sod(calendar, (int64_t) calendar->sod + ((int64_t) val - old) * FACTOR[field]);
+            break;
+        }
+        case CRON_CF_DAY_OF_MONTH:
+            civil_set_days(calendar, calendar->days + (int64_t) val - calendar->mday);
+            break;
+        case CRON_CF_MONTH:
+            civil_set_date(calendar, calendar->year, val, calendar->mday);
+            break;
+        case CRON_CF_YEAR:
+            civil_set_date(calendar, 1900 + (int64_t) val, calendar->mon, calendar->mday);
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * Day selected by a 'W' flag in a month: the weekday nearest to the flagged day, without leaving the month.
+ *
+ * @param first first day of the month, in days since 1970-01-01
+ * @param lastday last day of that month
+ * @param flag bit of the flag in w_flags: the flagged day, 0 for 'LW' (last weekday of the month)
+ */
+static unsigned int civil_w_day(int64_t first, unsigned int lastday, unsigned int flag) {
+    unsigned int day = 0 == flag ? lastday : flag;
+    int wday = weekday_from_days(first + day - 1);
+    if (0 == flag) {
+        // Last weekday of month: back to friday
+        if (0 == wday) day -= 2;
+        if (6 == wday) day -= 1;
+    } else if (1 == day) {
+        // First of the month must only move further into the month
+        if (6 == wday) day += 2;
+        if (0 == wday) day += 1;
+    } else if (6 == wday) {
+        day -= 1;
+    } else if (0 == wday) {
+        // Sunday: monday, unless that is in the next month, then back to friday
+        day = day < lastday ? day + 1 : day - 2;
+    }
+    return day;
+}
+
+/** Add the days selected by 'L' and 'W' flags in a month to cur_doms; counterpart of
+ * find_l_days() and find_w_days(), computing the weekdays arithmetically.
+ *
+ * @param expr parsed cron expression, for its L/W flags
+ * @param first first day of the month to resolve the flags for, in days since 1970-01-01
+ * @param lastday last day of that month
+ * @param lw_flags bitflags for set 'L' and 'W' flags types
+ * @param cur_doms (copied) bits for the cron days of month, days will be set here
+ * @param res_out set to 1 if the flags couldn't be resolved
+ */
+static void civil_lw_days(const cron_expr *expr, int64_t first, unsigned int lastday, uint8_t lw_flags,
+                          uint8_t *cur_doms, int *res_out) {
+    int notfound = 0;
+    unsigned int offset;
+    int wday;
+
+    if (lw_flags & L_DOM_FLAG) {
+        offset = next_set_bit(expr->l_dom_offset, CRON_MAX_DAYS_OF_MONTH, 0, &notfound);
+        while (!notfound) {
+            // Allow at least one execution this month if the offset reaches before the 1st
+            cron_setBit(cur_doms, offset >= lastday ? 1 : lastday - offset);
+            offset = next_set_bit(expr->l_dom_offset, lastday, offset + 1, &notfound);
+        }
+    } else if (lw_flags & L_DOW_FLAG) {
+        memset(cur_doms, 0, 4);
+        offset = next_set_bit(expr->l_dow_flags, CRON_MAX_DAYS_OF_WEEK, 0, &notfound);
+        if (notfound) {
+            *res_out = 1;
+            return;
+        }
+        wday = weekday_from_days(first + lastday - 1);
+        cron_setBit(cur_doms, lastday - (unsigned int) ((wday - (int) offset + 7) % 7));
+    }
+
+    notfound = 0;
+    offset = next_set_bit(expr->w_flags, lastday + 1, 0, &notfound);
+    while (!notfound) {
+        cron_setBit(cur_doms, civil_w_day(first, lastday, offset));
+        offset = next_set_bit(expr->w_flags, lastday + 1, offset + 1, &notfound);
+    }
+}
+
+/* cron_month_doms.month before the days of a month are resolved, no year * 12 + month of a cron_civil */
+#define CRON_MONTH_UNRESOLVED INT64_MIN
+
+/** Days of month of one month with the L/W flags resolved, memoized over the calls of a search */
+typedef struct {
+    int64_t month; /* year * 12 + month of year of doms, CRON_MONTH_UNRESOLVED if not resolved yet */
+    uint8_t doms[4];
+    uint32_t days; /* bits 1-31: days of the month in doms falling on a day of week of the expression */
+} cron_month_doms;
+
+/**
+ * Resolve the days of month of the month of calendar into cache->doms, unless they are already resolved
+ * for that month.
+ *
+ * @param expr parsed cron expression
+ * @param calendar date within the month to resolve
+ * @param lw_flags bitflags for set 'L' and 'W' flags types of expr
+ * @param cache memoized days of month, updated if the month differs
+ * @param res_out set to 1 if the flags couldn't be resolved
+ */
+static void civil_month_doms(const cron_expr *expr, const cron_civil *calendar, uint8_t lw_flags,
+                             cron_month_doms *cache, int *res_out) {
+    int64_t month = (int64_t) calendar->year * 12 + calendar->mon;
+    int64_t first = calendar->days - (calendar->mday - 1);
+    unsigned int lastday;
+    if (cache->month == month) {
+        return;
+    }
+    lastday = days_in_month(calendar->year, calendar->mon + 1);
+    memcpy(cache->doms, expr->days_of_month, 4);
+    if (lw_flags) {
+        civil_lw_days(expr, first, lastday, lw_flags, cache->doms, res_out);
+        if (*res_out) {
+            cache->month = CRON_MONTH_UNRESOLVED;
+            return;
+        }
+    }
+    cache->days = (uint32_t) load_bits(cache->doms, CRON_MAX_DAYS_OF_MONTH) &
+                  month_weekdays(expr->days_of_week, (unsigned int) weekday_from_days(first), lastday);
+    cache->month = month;
+}
+
+
+/**
+ * Days of a month matching the months, day of month (including L/W flags) and day of week fields,
+ * as bits 1-31 of a mask.
+ *
+ * @param expr parsed cron expression
+ * @param lw_flags bitflags for set 'L' and 'W' flags types of expr
+ * @param year gregorian year of the month
+ * @param mon month of year, 0-11
+ * @param res_out set to 1 if the L/W flags couldn't be resolved
+ */
+static uint32_t civil_month_days(const cron_expr *expr, uint8_t lw_flags, int64_t year, unsigned int mon,
+                                 int *res_out) {
+    int64_t first = days_from_civil(year, mon + 1, 1);
+    unsigned int lastday = days_in_month(year, mon + 1);
+    uint8_t cur_doms[4];
+    if (!cron_getBit(expr->months, mon)) {
+        return 0;
+    }
+    memcpy(cur_doms, expr->days_of_month, 4);
+    if (lw_flags) {
+        civil_lw_days(expr, first, lastday, lw_flags, cur_doms, res_out);
+        if (*res_out) {
+            return 0;
+        }
+    }
+    return (uint32_t) load_bits(cur_doms, CRON_MAX_DAYS_OF_MONTH) &
+           month_weekdays(expr->days_of_week, (unsigned int) weekday_from_days(first), lastday);
+}
+
+/**
+ * Move to the next month after year-mon with days matching expr, skipping months not in the months field.
+ *
+ * @param expr parsed cron expression
+ * @param lw_flags bitflags for set 'L' and 'W' flags types of expr
+ * @param year gregorian year of the month, replaced with the one of the matching month
+ * @param mon month of year, 0-11, replaced with the matching month
+ * @param mask_out set to the matching days of the month, as returned by civil_month_days()
+ * @return Error code: 0 on success, -1 if no month of a full 400-year cycle matches or L/W flags couldn't be resolved.
+ */
+static int civil_next_month(const cron_expr *expr, uint8_t lw_flags, int64_t *year, unsigned int *mon,
+                            uint32_t *mask_out) {
+    unsigned int searched = 0;
+    int notfound = 0;
+    int res = 0;
+    while (searched <= CRON_CYCLE_MONTHS) {
+        unsigned int next = next_set_bit(expr->months, CRON_MAX_MONTHS - 1, *mon + 1, &notfound);
+        if (notfound) {
+            notfound = 0;
+            next = next_set_bit(expr->months, CRON_MAX_MONTHS - 1, 0, &notfound);
+            if (notfound) return -1;
+            searched += next + 12 - *mon;
+            (*year)++;
+        } else {
+            searched += next - *mon;
+        }
+        *mon = next;
+        *mask_out = civil_month_days(expr, lw_flags, *year, *mon, &res);
+        if (res) return -1;
+        if (*mask_out) return 0;
+    }
+    return -1;
+}
+
+/** Counterpart of civil_next_month() moving to the previous month before year-mon with matching days */
+static int civil_prev_month(const cron_expr *expr, uint8_t lw_flags, int64_t *year, unsigned int *mon,
+                            uint32_t *mask_out) {
+    unsigned int searched = 0;
+    int notfound = 0;
+    int res = 0;
+    while (searched <= CRON_CYCLE_MONTHS) {
+        unsigned int prev = 0 == *mon ? 0 : prev_set_bit(expr->months, CRON_MAX_MONTHS - 1, *mon - 1, &notfound);
+        if (0 == *mon || notfound) {
+            notfound = 0;
+            prev = prev_set_bit(expr->months, CRON_MAX_MONTHS - 1, CRON_MAX_MONTHS - 2, &notfound);
+            if (notfound) return -1;
+            searched += *mon + 12 - prev;
+            (*year)--;
+        } else {
+            searched += *mon - prev;
+        }
+        *mon = prev;
+        *mask_out = civil_month_days(expr, lw_flags, *year, *mon, &res);
+        if (res) return -1;
+        if (*mask_out) return 0;
+    }
+    return -1;
+}
+
+/** Counterpart of reset() */
+static void civil_reset(cron_civil *calendar, cron_cf field) {
+    civil_set(calendar, field, CRON_CF_DAY_OF_MONTH == field ? 1 : 0);
+}
+
+/** Counterpart of reset_all() */
+static void civil_reset_all(cron_civil *calendar, uint8_t *reset_fields) {
+    int i;
+    for (i = 0; i < CRON_CF_ARR_LEN; i++) {
+        if (!(*reset_fields & (1 << i))) {
+            civil_reset(calendar, (cron_cf) i);
+            *reset_fields |= 1 << i;
+        }
+    }
+}
+
+/** Counterpart of find_next() */
+static unsigned int
+civil_find_next(const uint8_t *bits, unsigned int max, unsigned int value, cron_civil *calendar, cron_cf field,
+                cron_cf nextField, uint8_t *reset_fields, int *res_out) {
+    int notfound = 0;
+    unsigned int next_value = next_set_bit(bits, max, value, &notfound);
+    /* roll over if needed */
+    if (notfound) {
+        civil_add(calendar, nextField, 1);
+        civil_reset(calendar, field);
+        notfound = 0;
+        next_value = next_set_bit(bits, max, 0, &notfound);
+        if (notfound) {
+            *res_out = 1;
+            return 0;
+        }
+    }
+    if (next_value != value) {
+        civil_reset_all(calendar, reset_fields);
+        civil_set(calendar, field, next_value);
+    }
+    return next_value;
+}
+
+/**
+ * Counterpart of find_next_day(): the next matching day is found with one bit scan of the days mask of the month,
+ * months without a matching day (or not in the months of the expression) are skipped at once. Gives up after a
+ * year of empty months, leaving the calendar at the first day of a month for the caller to go on from there.
+ */
+static unsigned int
+civil_find_next_day(const cron_expr *expr, cron_civil *calendar, uint8_t lw_flags, cron_month_doms *cur_doms,
+                    uint8_t *reset_fields, int *res_out) {
+    unsigned int day_of_month = calendar->mday;
+    unsigned int next_day;
+    unsigned int months = 0;
+    uint32_t days;
+    for (;;) {
+        civil_month_doms(expr, calendar, lw_flags, cur_doms, res_out);
+        if (*res_out) {
+            return 0;
+        }
+        days = cron_getBit(expr->months, calendar->mon) ? cur_doms->days >> day_of_month << day_of_month : 0;
+        if (days) {
+            next_day = count_trailing_zeros(days);
+            if (next_day != day_of_month) {
+                civil_set_days(calendar, calendar->days + next_day - day_of_month);
+                civil_reset_all(calendar, reset_fields);
+            }
+            return next_day;
+        }
+        // First day of the next month
+        civil_set_days(calendar, calendar->days + days_in_month(calendar->year, calendar->mon + 1) - day_of_month + 1);
+        civil_reset_all(calendar, reset_fields);
+        day_of_month = 1;
+        if (++months > 12) {
+            return day_of_month;
+        }
+    }
+}
+
+/**
+ * Counterpart of do_next() working on a cron_civil calendar.
+ *
+ * @param expr The parsed cron expression.
+ * @param calendar The time after which the next cron trigger should be found. If successful, will be replaced with the next trigger time.
+ * @param dot Year of the original time. If no trigger is found within 5 years, an error code (-1) is returned.
+ * @return Error code: 0 on success, other values (e. g. -1) mean failure.
+ */
+static int civil_do_next(const cron_expr *expr, cron_civil *calendar, int dot) {
+    int res = 0;
+    uint8_t reset_fields = 0xFE;
+    uint8_t second_reset_fields = 0xFF;
+    unsigned int value = 0;
+    unsigned int update_value = 0;
+    int64_t day = 0;
+    uint8_t l_flags = get_lw_flags(expr);
+    cron_month_doms cur_doms;
+    cur_doms.month = CRON_MONTH_UNRESOLVED;
+
+    while (reset_fields) {
+        if (calendar->overflow || calendar->year - dot > 5) {
+            return -1;
+        }
+        value = civil_get(calendar, CRON_CF_SECOND);
+        update_value = civil_find_next(expr->seconds, CRON_MAX_SECONDS, value, calendar, CRON_CF_SECOND,
+                                       CRON_CF_MINUTE, &second_reset_fields, &res);
+        if (0 != res) return res;
+        if (value == update_value) {
+            push_to_fields_arr(&reset_fields, CRON_CF_SECOND);
+        }
+
+        value = civil_get(calendar, CRON_CF_MINUTE);
+        update_value = civil_find_next(expr->minutes, CRON_MAX_MINUTES, value, calendar, CRON_CF_MINUTE,
+                                       CRON_CF_HOUR_OF_DAY, &reset_fields, &res);
+        if (0 != res) return res;
+        if (value != update_value) continue;
+        push_to_fields_arr(&reset_fields, CRON_CF_MINUTE);
+
+        value = civil_get(calendar, CRON_CF_HOUR_OF_DAY);
+        update_value = civil_find_next(expr->hours, CRON_MAX_HOURS, value, calendar, CRON_CF_HOUR_OF_DAY,
+                                       CRON_CF_DAY_OF_WEEK, &reset_fields, &res);
+        if (0 != res) return res;
+        if (value != update_value) continue;
+        push_to_fields_arr(&reset_fields, CRON_CF_HOUR_OF_DAY);
+
+        day = calendar->days;
+        civil_find_next_day(expr, calendar, l_flags, &cur_doms, &reset_fields, &res);
+        if (0 != res) return res;
+        if (day != calendar->days) continue;
+        push_to_fields_arr(&reset_fields, CRON_CF_DAY_OF_MONTH);
+
+        value = calendar->mon;
+        update_value = civil_find_next(expr->months, CRON_MAX_MONTHS - 1, value, calendar, CRON_CF_MONTH,
+                                       CRON_CF_YEAR, &reset_fields, &res);
+        if (0 != res) return res;
+        if (value != update_value) continue;
+        return 0;
+    }
+    return res;
+}
+
+/** Counterpart of civil_set() for the reverse search: moves field to its maximum value, the day of month to the
+ * last day of the current month. */
+static void civil_set_max(cron_civil *calendar, cron_cf field) {
+    switch (field) {
+        case CRON_CF_SECOND:
+        case CRON_CF_MINUTE:
+            civil_set(calendar, field, 59);
+            break;
+        case CRON_CF_HOUR_OF_DAY:
+            civil_set(calendar, field, 23);
+            break;
+        case CRON_CF_DAY_OF_MONTH:
+            civil_set(calendar, field, days_in_month(calendar->year, calendar->mon + 1));
+            break;
+        case CRON_CF_MONTH:
+            civil_set_month(calendar, calendar->year, 11);
+            break;
+        default:
+            break;
+    }
+}
+
+/** Counterpart of civil_reset_all() for the reverse search, moving the fields to their maximum */
+static void civil_set_max_all(cron_civil *calendar, uint8_t *reset_fields) {
+    int i;
+    for (i = CRON_CF_ARR_LEN - 1; i >= 0; i--) {
+        if (!(*reset_fields & (1 << i))) {
+            civil_set_max(calendar, (cron_cf) i);
+            *reset_fields |= 1 << i;
+        }
+    }
+}
+
+/** Counterpart of civil_find_next(), searching the previous set bit at or before value. A roll over moves
+ * nextField back by one, and lower fields are moved to their maximum when the field changes. */
+static unsigned int
+civil_find_prev(const uint8_t *bits, unsigned int max, unsigned int value, cron_civil *calendar, cron_cf field,
+                cron_cf nextField, uint8_t *reset_fields, int *res_out) {
+    int notfound = 0;
+    unsigned int prev_value = prev_set_bit(bits, max, value, &notfound);
+    /* roll over if needed */
+    if (notfound) {
+        if (CRON_CF_YEAR == nextField) {
+            civil_set_month(calendar, calendar->year - 1, calendar->mon);
+        } else {
+            civil_add(calendar, nextField, -1);
+        }
+        civil_set_max(calendar, field);
+        notfound = 0;
+        prev_value = prev_set_bit(bits, max, max - 1, &notfound);
+        if (notfound) {
+            *res_out = 1;
+            return 0;
+        }
+    }
+    if (prev_value != value) {
+        if (CRON_CF_MONTH == field) {
+            civil_set_month(calendar, calendar->year, prev_value);
+        } else {
+            civil_set(calendar, field, prev_value);
+        }
+        civil_set_max_all(calendar, reset_fields);
+    }
+    return prev_value;
+}
+
+/** Counterpart of civil_find_next_day(), scanning the days mask of the month downwards and skipping back to the
+ * last day of the previous month when no day at or before the current one matches */
+static unsigned int
+civil_find_prev_day(const cron_expr *expr, cron_civil *calendar, uint8_t lw_flags, cron_month_doms *cur_doms,
+                    uint8_t *reset_fields, int *res_out) {
+    unsigned int day_of_month = calendar->mday;
+    unsigned int prev_day;
+    unsigned int months = 0;
+    uint32_t days;
+    for (;;) {
+        civil_month_doms(expr, calendar, lw_flags, cur_doms, res_out);
+        if (*res_out) {
+            return 0;
+        }
+        days = cron_getBit(expr->months, calendar->mon) ?
+               (uint32_t) (cur_doms->days & ((UINT64_C(2) << day_of_month) - 1)) : 0;
+        if (days) {
+            prev_day = highest_set_bit(days);
+            if (prev_day != day_of_month) {
+                civil_set_days(calendar, calendar->days - (day_of_month - prev_day));
+                civil_set_max_all(calendar, reset_fields);
+            }
+            return prev_day;
+        }
+        // Last day of the previous month
+        civil_set_days(calendar, calendar->days - day_of_month);
+        civil_set_max_all(calendar, reset_fields);
+        day_of_month = calendar->mday;
+        if (++months > 12) {
+            return day_of_month;
+        }
+    }
+}
+
+/**
+ * Find the last time at or before *calendar* at which the cron will be triggered; civil_do_next() in reverse.
+ *
+ * @param expr The parsed cron expression.
+ * @param calendar The time at or before which the previous cron trigger should be found. If successful, will be replaced with it.
+ * @param dot Year of the original time. If no trigger is found within 5 years back, an error code (-1) is returned.
+ * @return Error code: 0 on success, other values (e. g. -1) mean failure.
+ */
+static int civil_do_prev(const cron_expr *expr, cron_civil *calendar, int dot) {
+    int res = 0;
+    uint8_t reset_fields = 0xFE;
+    uint8_t second_reset_fields = 0xFF;
+    unsigned int value = 0;
+    unsigned int update_value = 0;
+    int64_t day = 0;
+    uint8_t l_flags = get_lw_flags(expr);
+    cron_month_doms cur_doms;
+    cur_doms.month = CRON_MONTH_UNRESOLVED;
+
+    while (reset_fields) {
+        if (calendar->overflow || dot - calendar->year > 5) {
+            return -1;
+        }
+        value = civil_get(calendar, CRON_CF_SECOND);
+        update_value = civil_find_prev(expr->seconds, CRON_MAX_SECONDS, value, calendar, CRON_CF_SECOND,
+                                       CRON_CF_MINUTE, &second_reset_fields, &res);
+        if (0 != res) return res;
+        if (value == update_value) {
+            push_to_fields_arr(&reset_fields, CRON_CF_SECOND);
+        }
+
+        value = civil_get(calendar, CRON_CF_MINUTE);
+        update_value = civil_find_prev(expr->minutes, CRON_MAX_MINUTES, value, calendar, CRON_CF_MINUTE,
+                                       CRON_CF_HOUR_OF_DAY, &reset_fields, &res);
+        if (0 != res) return res;
+        if (value != update_value) continue;
+        push_to_fields_arr(&reset_fields, CRON_CF_MINUTE);
+
+        value = civil_get(calendar, CRON_CF_HOUR_OF_DAY);
+        update_value = civil_find_prev(expr->hours, CRON_MAX_HOURS, value, calendar, CRON_CF_HOUR_OF_DAY,
+                                       CRON_CF_DAY_OF_WEEK, &reset_fields, &res);
+        if (0 != res) return res;
+        if (value != update_value) continue;
+        push_to_fields_arr(&reset_fields, CRON_CF_HOUR_OF_DAY);
+
+        day = calendar->days;
+        civil_find_prev_day(expr, calendar, l_flags, &cur_doms, &reset_fields, &res);
+        if (0 != res) return res;
+        if (day != calendar->days) continue;
+        push_to_fields_arr(&reset_fields, CRON_CF_DAY_OF_MONTH);
+
+        value = calendar->mon;
+        update_value = civil_find_prev(expr->months, CRON_MAX_MONTHS - 1, value, calendar, CRON_CF_MONTH,
+                                       CRON_CF_YEAR, &reset_fields, &res);
+        if (0 != res) return res;
+        if (value != update_value) continue;
+        return 0;
+    }
+    return res;
+}
+
+/**
+ * Copy the next element of a list at *str to token and move *str past it. Elements are separated by del; empty
+ * elements and white space are skipped.
+ *
+ * @param token receives the nul-terminated element, needs room for strlen(*str) + 1 chars
+ * @return 1 if an element was found, 0 at the end of the list.
+ */
+static int next_token(const char **str, char del, char *token) {
+    const char *cur = *str;
+    size_t len = 0;
+    for (; '\0' != *cur; cur++) {
+        if (del == *cur) {
+            if (len > 0) break;
+        } else if (!isspace((unsigned char) *cur)) {
+            token[len++] = *cur;
+        }
+    }
+    token[len] = '\0';
+    *str = cur;
+    return len > 0;
+}
+
+/** Whether lists in str are short enough to be split, see CRON_MAX_STR_LEN_TO_SPLIT */
+static int can_split(const char *str) {
+    return strlen(str) < CRON_MAX_STR_LEN_TO_SPLIT;
+}
+
+static int hash_seed = 0;
+static cron_custom_hash_fn fn = NULL;
+
+void cron_init_hash(int seed) {
+    hash_seed = seed;
+}
+
+void cron_init_custom_hash_fn(cron_custom_hash_fn func) {
+    fn = func;
+}
+
+/**
+ * Values for the 'H' of each field, taken once per parse from the global hash settings so that the parser itself
+ * doesn't touch them.
+ *
+ * @param hashes receives the values for the 6 fields
+ */
+static void get_hashes(unsigned int *hashes) {
+    unsigned int i;
+    if (fn) {
+        for (i = 0; i < 6; i++) {
+            hashes[i] = fn(hash_seed, (uint8_t) i);
+        }
+    } else {
+        // Value of field i is the (i+1)-th rand() after seeding with hash_seed
+        int newSeed = rand();
+        srand(hash_seed);
+        for (i = 0; i < 6; i++) {
+            hashes[i] = rand();
+        }
+        srand(newSeed);
+    }
+}
+
+void cron_setBit(uint8_t *rbyte, unsigned int idx) {
+    uint8_t j = idx / 8;
+    uint8_t k = idx % 8;
+
+    rbyte[j] |= (1 << k);
+}
+
+void cron_delBit(uint8_t *rbyte, unsigned int idx) {
+    uint8_t j = idx / 8;
+    uint8_t k = idx % 8;
+
+    rbyte[j] &= ~(1 << k);
+}
+
+uint8_t cron_getBit(const uint8_t *rbyte, unsigned int idx) {
+    uint8_t j = idx / 8;
+    uint8_t k = idx % 8;
+
+    if (rbyte[j] & (1 << k)) {
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/*
+ * Expression parser
+ *
+ * Each field is read once, straight from the expression: a small reader hands out its characters, skipping white
+ * space like next_token() does, and each list element is parsed from it as '*', a value (digits or a name like
+ * "MON"), a range or 'H' (optionally with a custom range), followed by an 'L' or 'W' flag or a step. All state
+ * lives on the stack.
+ */
+
+/** Parsing rules of one field */
+typedef struct {
+    unsigned int pos; /* position in the expression, CRON_FIELD_* */
+    unsigned int min; /* lowest value */
+    unsigned int max; /* highest value + 1 */
+    unsigned int hash_min; /* lowest value of 'H' */
+    unsigned int hash_max; /* highest value of 'H' + 1 */
+    const char **names; /* names of the values 0, 1, ... read as those values, NULL if the field has none */
+    unsigned int names_len;
+} cron_field;
+
+static const cron_field FIELDS[] = {
+        {CRON_FIELD_SECOND,       0, CRON_MAX_SECONDS,       0, CRON_MAX_SECONDS,      NULL,        0},
+        {CRON_FIELD_MINUTE,       0, CRON_MAX_MINUTES,       0, CRON_MAX_MINUTES,      NULL,        0},
+        {CRON_FIELD_HOUR,         0, CRON_MAX_HOURS,         0, CRON_MAX_HOURS,        NULL,        0},
+        // 'H' limited to the 28th so the hashed cron will be executed every month
+        {CRON_FIELD_DAY_OF_MONTH, 0, CRON_MAX_DAYS_OF_MONTH, 1, 28,                    NULL,        0},
+        {CRON_FIELD_MONTH,        1, CRON_MAX_MONTHS,        1, CRON_MAX_MONTHS,       MONTHS_ARR,  CRON_MONTHS_ARR_LEN},
+        {CRON_FIELD_DAY_OF_WEEK,  0, CRON_MAX_DAYS_OF_WEEK,  1, CRON_MAX_DAYS_OF_WEEK, DAYS_ARR,    CRON_DAYS_ARR_LEN}
+};
+
+/** Characters of one field of an expression */
+typedef struct {
+    const char *cur; /* next character */
+    const char *end; /* end of the field */
+    int upper; /* read letters as upper case, in the fields with names */
+} cron_reader;
+
+/** Next character of the field without consuming it, skipping white space; '\0' at the end of the field */
+static char reader_peek(cron_reader *reader) {
+    while (reader->cur < reader->end && isspace((unsigned char) *reader->cur)) {
+        reader->cur++;
+    }
+    if (reader->cur == reader->end) return '\0';
+    return reader->upper ? (char) toupper((unsigned char) *reader->cur) : *reader->cur;
+}
+
+/** Consume the next character of the field if it is ch */
+static int reader_accept(cron_reader *reader, char ch) {
+    if (reader_peek(reader) != ch) return 0;
+    reader->cur++;
+    return 1;
+}
+
+/** Whether the next character ends the list element */
+static int reader_at_separator(cron_reader *reader) {
+    char ch = reader_peek(reader);
+    return ',' == ch || '\0' == ch;
+}
+
+/**
+ * Read a value: decimal digits or, in fields with names, the name of a value.
+ *
+ * @return 0 on success, 1 if there is no value or it exceeds INT_MAX.
+ */
+static int read_value(cron_reader *reader, const cron_field *field, unsigned int *value) {
+    char ch = reader_peek(reader);
+    unsigned int i, j;
+    if (ch >= '0' && ch <= '9') {
+        uint64_t res = 0;
+        while ((ch = reader_peek(reader)) >= '0' && ch <= '9') {
+            res = res * 10 + (unsigned int) (ch - '0');
+            if (res > INT_MAX) return 1;
+            reader->cur++;
+        }
+        *value = (unsigned int) res;
+        return 0;
+    }
+    for (i = 0; i < field->names_len; i++) {
+        cron_reader name = *reader;
+        for (j = 0; '\0' != field->names[i][j] && reader_accept(&name, field->names[i][j]); j++) {}
+        if ('\0' == field->names[i][j]) {
+            *reader = name;
+            *value = i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Parse an 'L' element of the day of month ("L", "L-3" or "LW") or day of week field ("L" for sunday, "L-2" for
+ * 2 days before it). The reader is past the 'L'.
+ *
+ * @param set_value set to 1 and value to the day of week for the plain days of week "L" and "L-x"
+ */
+static void parse_l_element(cron_reader *reader, const cron_field *field, cron_expr *target, int *set_value,
+                            unsigned int *value, const char **error) {
+    unsigned int offset = 0;
+    if (reader_accept(reader, '-')) {
+        if (read_value(reader, field, &offset)) {
+            *error = "Error parsing L offset";
+            return;
+        }
+        if (0 == offset) {
+            *error = "Invalid offset: Needs to be > 0";
+            return;
+        }
+    }
+    if (CRON_FIELD_DAY_OF_MONTH == field->pos && 0 == offset && reader_accept(reader, 'W')) {
+        cron_setBit(target->w_flags, 0);
+        cron_setBit(target->months, CRON_W_DOM_BIT);
+    } else if (CRON_FIELD_DAY_OF_MONTH == field->pos) {
+        // Offsets beyond the month are capped, one execution per month is kept
+        cron_setBit(target->months, CRON_L_DOM_BIT);
+        cron_setBit(target->l_dom_offset, offset > 30 ? 30 : offset);
+    } else {
+        *set_value = 1;
+        *value = 0 == offset ? 0 : 7 - (offset > 6 ? 6 : offset);
+    }
+    if (!reader_at_separator(reader)) {
+        *error = "L only allowed in combination before an offset or before W";
+    }
+}
+
+/** Value of 'H' in [min, max[, taken from the hash of the field */
+static unsigned int hashed_value(const cron_field *field, unsigned int min, unsigned int max,
+                                 const unsigned int *hashes, const char **error) {
+    if (max > field->hash_max || max <= min) {
+        *error = "'H' range maximum error";
+        return 0;
+    }
+    return hashes[field->pos] % (max - min) + min;
+}
+
+/**
+ * Parse one element of a list and set the bits of its values, or the L/W flags it stands for.
+ *
+ * @param reader reader at the start of the element, moved past it
+ * @param field parsing rules of the field
+ * @param target expression, for the L/W flags
+ * @param bits receives the values of the element
+ * @param hashes values for 'H' of the fields from get_hashes()
+ * @param flag_out set to 1 if the element is an L/W flag instead of values
+ * @param error set in case of error
+ */
+static void parse_element(cron_reader *reader, const cron_field *field, cron_expr *target, uint8_t *bits,
+                          const unsigned int *hashes, int *flag_out, const char **error) {
+    unsigned int from = 0;
+    unsigned int to = 0;
+    unsigned int step = 1;
+    unsigned int hash_min = field->hash_min;
+    unsigned int hash_max = 0; // custom range of 'H', 0 if none
+    unsigned int i;
+    int single = 0; // a single value, taken up to the maximum by a step
+    int set_value = 0;
+    *flag_out = 0;
+
+    if ((CRON_FIELD_DAY_OF_MONTH == field->pos || CRON_FIELD_DAY_OF_WEEK == field->pos) &&
+        reader_accept(reader, 'L')) {
+        parse_l_element(reader, field, target, &set_value, &from, error);
+        if (*error) return;
+        if (set_value) {
+            cron_setBit(bits, from);
+        } else {
+            *flag_out = 1;
+        }
+        return;
+    }
+    if (reader_accept(reader, '*')) {
+        from = field->min;
+        to = field->max - 1;
+    } else if (reader_accept(reader, 'H')) {
+        single = 1;
+        if (reader_accept(reader, '(')) {
+            if (read_value(reader, field, &hash_min) || !reader_accept(reader, '-') ||
+                read_value(reader, field, &hash_max) || !reader_accept(reader, ')') || 0 == hash_max ||
+                hash_min > hash_max || hash_min < field->hash_min) {
+                *error = "'H' custom range error";
+                return;
+            }
+            hash_max++;
+        } else if ('/' == reader_peek(reader)) {
+            // A step right after 'H' limits its value instead of the range of the field
+            cron_reader peek = *reader;
+            peek.cur++;
+            if (read_value(&peek, field, &hash_max) || 0 == hash_max) {
+                *error = "Hashed: Iterator error";
+                return;
+            }
+        }
+        if ('-' == reader_peek(reader)) {
+            *error = "'H' is not allowed for use in ranges";
+            return;
+        }
+        from = hashed_value(field, hash_min, hash_max ? hash_max : field->hash_max, hashes, error);
+        if (*error) return;
+        to = from;
+    } else {
+        if (read_value(reader, field, &from)) {
+            *error = "Unsigned integer parse error";
+            return;
+        }
+        to = from;
+        single = 1;
+        if (reader_accept(reader, '-')) {
+            single = 0;
+            if (read_value(reader, field, &to)) {
+                *error = "Specified range doesn't have two fields";
+                return;
+            }
+        }
+    }
+    if (from >= field->max || to >= field->max) {
+        *error = "Specified range exceeds maximum";
+        return;
+    }
+    if (from < field->min || to < field->min) {
+        *error = "Specified range is less than minimum";
+        return;
+    }
+
+    // Flags after a single day: last given day of week of the month ("5L"), weekday nearest to a day ("15W")
+    if (single && CRON_FIELD_DAY_OF_WEEK == field->pos && reader_accept(reader, 'L')) {
+        cron_setBit(target->months, CRON_L_DOW_BIT);
+        // SUN is 0 bit, but can be '7' in field
+        cron_setBit(target->l_dow_flags, 7 == from ? 0 : from);
+        *flag_out = 1;
+    } else if (single && CRON_FIELD_DAY_OF_MONTH == field->pos && reader_accept(reader, 'W')) {
+        cron_setBit(target->w_flags, from);
+        cron_setBit(target->months, CRON_W_DOM_BIT);
+        *flag_out = 1;
+    } else if (reader_accept(reader, '/')) {
+        if (read_value(reader, field, &step)) {
+            *error = "Incrementer doesn't have two fields";
+            return;
+        }
+        if (step >= field->max) {
+            *error = "Incrementer too big";
+            return;
+        }
+        if (0 == step) {
+            *error = "Incrementer too small";
+            return;
+        }
+        if (single) {
+            to = field->max - 1;
+        }
+    }
+    if (!reader_at_separator(reader)) {
+        *error = "Unexpected character in field";
+        return;
+    }
+    if (*flag_out) return;
+    for (i = from; i <= to; i += step) {
+        cron_setBit(bits, i);
+    }
+}
+
+/**
+ * Parse a field of an expression: a list of elements separated by ','. Empty elements are skipped.
+ *
+ * @param begin first character of the field
+ * @param end end of the field
+ * @param field parsing rules of the field
+ * @param target expression, for the L/W flags
+ * @param bits receives the values of the field, at the bit of each value
+ * @param hashes values for 'H' of the fields from get_hashes()
+ * @param values_out set to the number of elements with values, which aren't L/W flags
+ * @param error set in case of error
+ */
+static void parse_field(const char *begin, const char *end, const cron_field *field, cron_expr *target,
+                        uint8_t *bits, const unsigned int *hashes, unsigned int *values_out, const char **error) {
+    cron_reader reader;
+    unsigned int elements = 0;
+    int flag;
+    reader.cur = begin;
+    reader.end = end;
+    reader.upper = NULL != field->names;
+    *values_out = 0;
+    while ('\0' != reader_peek(&reader)) {
+        if (reader_accept(&reader, ',')) continue;
+        parse_element(&reader, field, target, bits, hashes, &flag, error);
+        if (*error) return;
+        elements++;
+        if (!flag) (*values_out)++;
+    }
+    if (0 == elements) {
+        *error = "Comma split error";
+    }
+}
+
+/** Whether a field consists of the single character ch, e.g. '*' */
+static int field_is(const char *begin, const char *end, char ch) {
+    cron_reader reader;
+    reader.cur = begin;
+    reader.end = end;
+    reader.upper = 0;
+    return reader_accept(&reader, ch) && '\0' == reader_peek(&reader);
+}
+
+/**
+ * Check if the set bits [0:max[ of bits are an arithmetic progression covering the whole field, i.e. every step-th
+ * value starting at first with step a divisor of max. A single value has step max.
+ */
+static int is_progression(const uint8_t *bits, unsigned int max, unsigned int *first, unsigned int *step) {
+    uint64_t word = load_bits(bits, max);
+    uint64_t expected = 0;
+    unsigned int i;
+    if (!word) {
+        return 0;
+    }
+    *first = count_trailing_zeros(word);
+    word &= ~(UINT64_C(1) << *first);
+    *step = word ? count_trailing_zeros(word) - *first : max;
+    if (0 != max % *step || *first >= *step) {
+        return 0;
+    }
+    for (i = *first + *step; i < max; i += *step) {
+        expected |= UINT64_C(1) << i;
+    }
+    return word == expected;
+}
+
+/** Select the evaluator of cron_next() for a parsed expression, see cron_kind */
+static void classify_expr(cron_expr *target) {
+    unsigned int first[3];
+    unsigned int step[3];
+    uint64_t doms = load_bits(target->days_of_month, CRON_MAX_DAYS_OF_MONTH) | 1;
+    uint64_t months = load_bits(target->months, CRON_MAX_MONTHS - 1);
+    uint64_t dows = load_bits(target->days_of_week, CRON_MAX_DAYS_OF_WEEK - 1);
+    int64_t year = 1999;
+    unsigned int mon = 11;
+    uint32_t mask;
+    target->kind = CRON_KIND_GENERAL;
+    // Months of a 400-year cycle from 2000 on: any day of a month falls on every day of the week in one
+    if (!load_bits(target->seconds, CRON_MAX_SECONDS) || !load_bits(target->minutes, CRON_MAX_MINUTES) ||
+        !load_bits(target->hours, CRON_MAX_HOURS) ||
+        0 != civil_next_month(target, get_lw_flags(target), &year, &mon, &mask)) {
+        target->kind = CRON_KIND_NEVER;
+        return;
+    }
+    if (!months || !dows) {
+        return;
+    }
+    if (get_lw_flags(target) || doms != UINT32_C(0xFFFFFFFF) || months != 0xFFF || dows != 0x7F) {
+        // Matching on less than half of the days of a month or week, or in some months only: the bottom up search
+        // would mostly be rolling over days and months
+        if (get_lw_flags(target) || count_set_bits(doms) <= 16 || months != 0xFFF || count_set_bits(dows) <= 3) {
+            target->kind = CRON_KIND_SPARSE;
+        }
+        return;
+    }
+    target->kind = CRON_KIND_EVERY_DAY;
+    if (!is_progression(target->seconds, CRON_MAX_SECONDS, &first[0], &step[0]) ||
+        !is_progression(target->minutes, CRON_MAX_MINUTES, &first[1], &step[1]) ||
+        !is_progression(target->hours, CRON_MAX_HOURS, &first[2], &step[2])) {
+        return;
+    }
+    // The lowest field with more than one value sets the period, all higher fields must allow every value
+    if (step[0] < CRON_MAX_SECONDS) {
+        if (1 != step[1] || 1 != step[2]) return;
+        target->period = step[0];
+    } else if (step[1] < CRON_MAX_MINUTES) {
+        if (1 != step[2]) return;
+        target->period = step[1] * 60;
+    } else {
+        target->period = step[2] * 3600;
+    }
+    target->offset = first[2] * 3600 + first[1] * 60 + first[0];
+    target->kind = CRON_KIND_PERIOD;
+}
+
+/**
+ * Split an expression into its fields separated by ' ', skipping white space like next_token().
+ *
+ * @param buf receives the nul-terminated fields, needs room for CRON_MAX_STR_LEN_TO_SPLIT chars
+ * @param fields receives the first 6 fields
+ * @return number of fields, 0 if the expression is too long
+ */
+static size_t split_fields(const char *expression, char *buf, char **fields) {
+    const char *cur = expression;
+    size_t len = 0;
+    if (!can_split(expression)) return 0;
+    // Each field but the last one is followed by a ' ' its nul replaces, so they fit into buf
+    while (next_token(&cur, ' ', buf)) {
+        if (len < 6) fields[len] = buf;
+        buf += strlen(buf) + 1;
+        len++;
+    }
+    return len;
+}
+
+/**
+ * Find the fields of an expression separated by ' ', without copying them. Fields of white space only are skipped
+ * like split_fields() does.
+ *
+ * @param begins receives the first character of the first 6 fields
+ * @param ends receives the end of the first 6 fields
+ * @return number of fields, 0 if the expression is too long
+ */
+static size_t find_fields(const char *expression, const char **begins, const char **ends) {
+    const char *cur = expression;
+    size_t len = 0;
+    if (!can_split(expression)) return 0;
+    while ('\0' != *cur) {
+        const char *begin;
+        int blank = 1;
+        if (' ' == *cur) {
+            cur++;
+            continue;
+        }
+        for (begin = cur; '\0' != *cur && ' ' != *cur; cur++) {
+            if (!isspace((unsigned char) *cur)) blank = 0;
+        }
+        if (blank) continue;
+        if (len < 6) {
+            begins[len] = begin;
+            ends[len] = cur;
+        }
+        len++;
+    }
+    return len;
+}
+
+/** cron_parse_expr() with the values for 'H' given, not depending on global state */
+static void parse_expr(const char *expression, cron_expr *target, const unsigned int *hashes, const char **error) {
+    static const char any[] = "*";
+    const char *begins[6];
+    const char *ends[6];
+    unsigned int values;
+    unsigned int i;
+    int dom_any, dow_any;
+    *error = NULL;
+    memset(target, 0, sizeof(*target));
+
+    if (find_fields(expression, begins, ends) != 6) {
+        *error = "Invalid number of fields, expression must consist of 6 fields";
+        return;
+    }
+
+    parse_field(begins[0], ends[0], &FIELDS[CRON_FIELD_SECOND], target, target->seconds, hashes, &values, error);
+    if (*error) return;
+    parse_field(begins[1], ends[1], &FIELDS[CRON_FIELD_MINUTE], target, target->minutes, hashes, &values, error);
+    if (*error) return;
+    parse_field(begins[2], ends[2], &FIELDS[CRON_FIELD_HOUR], target, target->hours, hashes, &values, error);
+    if (*error) return;
+
+    // Don't allow specific values for DOM and DOW at the same time
+    dom_any = field_is(begins[3], ends[3], '*') || field_is(begins[3], ends[3], '?');
+    dow_any = field_is(begins[5], ends[5], '*') || field_is(begins[5], ends[5], '?');
+    if (!dom_any && !dow_any) {
+        *error = "Cannot set specific values for day of month AND day of week";
+        return;
+    }
+    // '?' stands for any day
+    for (i = 3; i < 6; i += 2) {
+        if (field_is(begins[i], ends[i], '?')) {
+            begins[i] = any;
+            ends[i] = any + 1;
+        }
+    }
+
+    parse_field(begins[5], ends[5], &FIELDS[CRON_FIELD_DAY_OF_WEEK], target, target->days_of_week, hashes, &values,
+                error);
+    if (*error) return;
+    if (0 == values) {
+        // Ensure all weekdays are available if the field has L flags only
+        parse_field(any, any + 1, &FIELDS[CRON_FIELD_DAY_OF_WEEK], target, target->days_of_week, hashes, &values,
+                    error);
+    }
+    if (cron_getBit(target->days_of_week, 7)) {
+        /* Sunday can be represented as 0 or 7*/
+        cron_setBit(target->days_of_week, 0);
+        cron_delBit(target->days_of_week, 7);
+    }
+
+    // Days of month: Ensure L-flag for dow is unset, unless the field is '*'
+    if (!dom_any && cron_getBit(target->months, CRON_L_DOW_BIT)) {
+        *error = "Cannot specify specific days of month when using 'L' in days of week.";
+        return;
+    }
+    // Days of month start with 1 (in Cron and Calendar), day 0 is removed again. Elements with L/W flags only
+    // (e.g. "LW" or "9W" or "L") leave the days empty.
+    parse_field(begins[3], ends[3], &FIELDS[CRON_FIELD_DAY_OF_MONTH], target, target->days_of_month, hashes,
+                &values, error);
+    if (*error) return;
+    cron_delBit(target->days_of_month, 0);
+
+    parse_field(begins[4], ends[4], &FIELDS[CRON_FIELD_MONTH], target, target->months, hashes, &values, error);
+    if (*error) return;
+    /* ... and then rotate it to the front of the months */
+    for (i = 1; i < CRON_MAX_MONTHS; i++) {
+        if (cron_getBit(target->months, i)) {
+            cron_setBit(target->months, i - 1);
+            cron_delBit(target->months, i);
+        }
+    }
+
+    classify_expr(target);
+}
+
+void cron_parse_expr(const char *expression, cron_expr *target, const char **error) {
+    const char *err_local;
+    unsigned int hashes[6] = {0, 0, 0, 0, 0, 0};
+    if (!error) {
+        error = &err_local;
+    }
+    *error = NULL;
+    if (!expression) {
+        *error = "Invalid NULL expression";
+        return;
+    }
+
+    if (!target) {
+        *error = "Invalid target";
+        return;
+    }
+    // The hash settings are only read for expressions which may contain an 'H'
+    if (strchr(expression, 'H') || strchr(expression, 'h')) {
+        get_hashes(hashes);
+    }
+    parse_expr(expression, target, hashes, error);
+}
+
+#define CRON_FNV_OFFSET UINT64_C(14695981039346656037)
+#define CRON_FNV_PRIME UINT64_C(1099511628211)
+
+/** FNV-1a hash of len bytes continuing from hash */
+static uint64_t hash_bytes(uint64_t hash, const char *str, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t) str[i]) * CRON_FNV_PRIME;
+    }
+    return hash;
+}
+
+/* Parse cache slot, free while hash is 0 */
+typedef struct {
+    uint64_t hash;
+    int seed; /* hash_seed and fn the 'H' of the key were replaced with */
+    cron_custom_hash_fn fn;
+    cron_expr expr;
+    char key[CRON_MAX_STR_LEN_TO_SPLIT];
+} cron_cache_slot;
+
+struct cron_parse_cache {
+    size_t capacity; /* maximum number of entries */
+    size_t count; /* number of entries */
+    size_t mask; /* number of slots - 1, a power of 2 at least twice the capacity */
+    cron_cache_slot *slots;
+    cron_allocator allocator;
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_t lock;
+#endif
+};
+
+cron_parse_cache *cron_parse_cache_create(size_t capacity) {
+    const cron_allocator *allocator = &cron_current_allocator;
+    size_t slots = 2;
+    cron_parse_cache *cache;
+    if (0 == capacity || capacity > SIZE_MAX / 2 / sizeof(cron_cache_slot)) return NULL;
+    while (slots < 2 * capacity) slots *= 2;
+    cache = (cron_parse_cache *) cron_alloc(allocator, sizeof(cron_parse_cache) + slots * sizeof(cron_cache_slot));
+    if (!cache) return NULL;
+    cache->capacity = capacity;
+    cache->count = 0;
+    cache->mask = slots - 1;
+    cache->slots = (cron_cache_slot *) (cache + 1);
+    cache->allocator = *allocator;
+    memset(cache->slots, 0, slots * sizeof(cron_cache_slot));
+#ifdef CRON_USE_THREADS
+    if (0 != pthread_rwlock_init(&cache->lock, NULL)) {
+        cron_free(allocator, cache);
+        return NULL;
+    }
+#endif
+    return cache;
+}
+
+void cron_parse_cache_free(cron_parse_cache *cache) {
+    if (!cache) return;
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_destroy(&cache->lock);
+#endif
+    cron_free(&cache->allocator, cache);
+}
+
+size_t cron_parse_cache_count(cron_parse_cache *cache) {
+    size_t count;
+    if (!cache) return 0;
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_rdlock(&cache->lock);
+#endif
+    count = cache->count;
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_unlock(&cache->lock);
+#endif
+    return count;
+}
+
+/** Slot of key in cache: the one holding it, or the free slot ending its probe sequence */
+static cron_cache_slot *cache_find(cron_parse_cache *cache, uint64_t hash, const char *key, int seed,
+                                   cron_custom_hash_fn func) {
+    size_t i = (size_t) hash & cache->mask;
+    for (;; i = (i + 1) & cache->mask) {
+        cron_cache_slot *slot = &cache->slots[i];
+        if (0 == slot->hash ||
+            (hash == slot->hash && seed == slot->seed && func == slot->fn && 0 == strcmp(key, slot->key))) {
+            return slot;
+        }
+    }
+}
+
+void cron_parse_expr_cached(cron_parse_cache *cache, const char *expression, cron_expr *target, const char **error) {
+    const char *err_local;
+    char buf[CRON_MAX_STR_LEN_TO_SPLIT];
+    char key[CRON_MAX_STR_LEN_TO_SPLIT];
+    char *fields[6];
+    char *end = key;
+    uint64_t hash;
+    int seed = 0;
+    cron_custom_hash_fn func = NULL;
+    cron_cache_slot *slot;
+    int found;
+    size_t i;
+    if (!error) {
+        error = &err_local;
+    }
+    if (!cache || !expression || !target || split_fields(expression, buf, fields) != 6) {
+        cron_parse_expr(expression, target, error);
+        return;
+    }
+    // Key: the fields separated by one ' ', as the parser sees them
+    for (i = 0; i < 6; i++) {
+        if (i > 0) *end++ = ' ';
+        strcpy(end, fields[i]);
+        end += strlen(end);
+    }
+    hash = hash_bytes(CRON_FNV_OFFSET, key, (size_t) (end - key));
+    // 'H' values depend on the hash settings
+    if (strchr(key, 'H') || strchr(key, 'h')) {
+        seed = hash_seed;
+        func = fn;
+        hash = (hash ^ (uint32_t) seed) * CRON_FNV_PRIME;
+    }
+    if (0 == hash) hash = 1;
+
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_rdlock(&cache->lock);
+#endif
+    slot = cache_find(cache, hash, key, seed, func);
+    found = 0 != slot->hash;
+    if (found) {
+        *target = slot->expr;
+        *error = NULL;
+    }
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_unlock(&cache->lock);
+#endif
+    if (found) return;
+
+    cron_parse_expr(key, target, error);
+    if (*error) return;
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_wrlock(&cache->lock);
+#endif
+    // Another thread may have added it in between; a full cache keeps its entries
+    slot = cache_find(cache, hash, key, seed, func);
+    if (!slot->hash && cache->count < cache->capacity) {
+        slot->seed = seed;
+        slot->fn = func;
+        slot->expr = *target;
+        strcpy(slot->key, key);
+        slot->hash = hash;
+        cache->count++;
+    }
+#ifdef CRON_USE_THREADS
+    pthread_rwlock_unlock(&cache->lock);
+#endif
+}
+
+/**
+ * Copy the first count fields of a line of len chars, separated by white space, to buf separated by one ' '.
+ *
+ * @param cap size of buf
+ * @return offset in line after the last field copied, (size_t) -1 if they don't fit into buf
+ */
+static size_t copy_fields(const char *line, size_t len, unsigned int count, char *buf, size_t cap) {
+    size_t used = 0;
+    size_t i = 0;
+    unsigned int field;
+    for (field = 0; field < count; field++) {
+        while (i < len && isspace((unsigned char) line[i])) i++;
+        if (i == len) break;
+        if (field > 0) buf[used++] = ' ';
+        while (i < len && !isspace((unsigned char) line[i])) {
+            if (used + 2 > cap) return (size_t) -1;
+            buf[used++] = line[i++];
+        }
+    }
+    buf[used] = '\0';
+    return i;
+}
+
+/** Parse the expression at the start of a line of len chars, the rest of the line is its id */
+static void parse_line(const char *line, size_t len, size_t offset, const unsigned int *hashes, cron_expr *target,
+                       cron_line *out) {
+    char buf[CRON_MAX_STR_LEN_TO_SPLIT];
+    size_t i = copy_fields(line, len, 6, buf, sizeof(buf));
+    size_t end = len;
+    if (i > len) {
+        memset(target, 0, sizeof(*target));
+        out->offset = offset;
+        out->id_offset = offset + len;
+        out->id_length = 0;
+        out->error = "Expression too long";
+        return;
+    }
+    while (i < end && isspace((unsigned char) line[i])) i++;
+    while (end > i && isspace((unsigned char) line[end - 1])) end--;
+    out->offset = offset;
+    out->id_offset = offset + i;
+    out->id_length = end - i;
+    parse_expr(buf, target, hashes, &out->error);
+}
+
+typedef struct {
+    const char *data;
+    size_t start; /* offset of the first line */
+    size_t end; /* offset after the last line */
+    size_t first; /* index of the first line */
+    size_t n; /* number of lines to parse in total */
+    const unsigned int *hashes;
+    cron_expr *exprs;
+    cron_line *lines;
+} cron_lines_chunk;
+
+static void lines_run(const cron_lines_chunk *chunk) {
+    size_t pos = chunk->start;
+    size_t index = chunk->first;
+    while (pos < chunk->end && index < chunk->n) {
+        const char *nl = (const char *) memchr(chunk->data + pos, '\n', chunk->end - pos);
+        size_t len = nl ? (size_t) (nl - chunk->data) - pos : chunk->end - pos;
+        parse_line(chunk->data + pos, len, pos, chunk->hashes, &chunk->exprs[index], &chunk->lines[index]);
+        pos += len + 1;
+        index++;
+    }
+}
+
+#ifdef CRON_USE_THREADS
+
+static void *lines_thread(void *arg) {
+    lines_run((const cron_lines_chunk *) arg);
+    return NULL;
+}
+
+#endif /* CRON_USE_THREADS */
+
+/** Number of lines in [start, end[ of data, ending with '\n' or end */
+static size_t count_lines(const char *data, size_t start, size_t end) {
+    size_t count = 0;
+    const char *nl;
+    while (start < end) {
+        nl = (const char *) memchr(data + start, '\n', end - start);
+        count++;
+        if (!nl) break;
+        start = (size_t) (nl - data) + 1;
+    }
+    return count;
+}
+
+size_t cron_count_lines(const char *data, size_t len) {
+    return data ? count_lines(data, 0, len) : 0;
+}
+
+size_t cron_parse_lines(const char *data, size_t len, cron_expr *exprs, cron_line *lines, size_t n,
+                        unsigned int threads) {
+    cron_lines_chunk chunks[CRON_BATCH_MAX_THREADS];
+    unsigned int hashes[6];
+#ifdef CRON_USE_THREADS
+    pthread_t ids[CRON_BATCH_MAX_THREADS];
+    int started[CRON_BATCH_MAX_THREADS];
+#endif
+    size_t i, start, total = 0;
+    if (!data || !exprs || !lines || 0 == n) return 0;
+#ifdef CRON_USE_THREADS
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int) cpus : 1;
+    }
+#else
+    threads = 1;
+#endif
+    if (threads > CRON_BATCH_MAX_THREADS) threads = CRON_BATCH_MAX_THREADS;
+    if (threads > (len + CRON_LINES_MIN_CHUNK - 1) / CRON_LINES_MIN_CHUNK) {
+        threads = (unsigned int) ((len + CRON_LINES_MIN_CHUNK - 1) / CRON_LINES_MIN_CHUNK);
+    }
+    if (0 == threads) threads = 1;
+    // Threads don't read the hash settings, all of them use the same values
+    get_hashes(hashes);
+    // Chunks of about equal size ending at line ends, the index of their first line is counted up front
+    for (i = 0, start = 0; i < threads; i++) {
+        size_t end = i + 1 < threads ? len / threads * (i + 1) : len;
+        const char *nl;
+        if (end < start) end = start;
+        if (end < len && end > 0 && '\n' != data[end - 1]) {
+            nl = (const char *) memchr(data + end, '\n', len - end);
+            end = nl ? (size_t) (nl - data) + 1 : len;
+        }
+        chunks[i].data = data;
+        chunks[i].start = start;
+        chunks[i].end = end;
+        chunks[i].first = total;
+        chunks[i].n = n;
+        chunks[i].hashes = hashes;
+        chunks[i].exprs = exprs;
+        chunks[i].lines = lines;
+        total += count_lines(data, start, end);
+        start = end;
+    }
+#ifdef CRON_USE_THREADS
+    for (i = 1; i < threads; i++) {
+        started[i] = chunks[i].first < n && 0 == pthread_create(&ids[i], NULL, lines_thread, &chunks[i]);
+    }
+#endif
+    lines_run(&chunks[0]);
+#ifdef CRON_USE_THREADS
+    for (i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(ids[i], NULL);
+        } else {
+            // Thread could not be started, parse its chunk here
+            lines_run(&chunks[i]);
+        }
+    }
+#endif
+    return total < n ? total : n;
+}
+
+struct cron_file {
+    char *data;
+    size_t size;
+    int mapped; /* data is mapped, otherwise allocated */
+    cron_allocator allocator;
+};
+
+cron_file *cron_file_map(const char *path, const char **error) {
+    const char *err_local;
+    cron_file *file;
+    if (!error) {
+        error = &err_local;
+    }
+    *error = NULL;
+    file = (cron_file *) cron_alloc(&cron_current_allocator, sizeof(cron_file));
+    if (!file) {
+        *error = "Out of memory";
+        return NULL;
+    }
+    memset(file, 0, sizeof(cron_file));
+    file->allocator = cron_current_allocator;
+#ifdef CRON_USE_MMAP
+    {
+        struct stat st;
+        int fd = path ? open(path, O_RDONLY) : -1;
+        if (fd < 0 || 0 != fstat(fd, &st)) {
+            if (fd >= 0) close(fd);
+            *error = "Cannot open file";
+            cron_file_unmap(file);
+            return NULL;
+        }
+        if (st.st_size > 0) {
+            void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (MAP_FAILED != data) {
+                file->data = (char *) data;
+                file->size = (size_t) st.st_size;
+                file->mapped = 1;
+#ifdef MADV_SEQUENTIAL
+                madvise(data, file->size, MADV_SEQUENTIAL);
+#endif
+            }
+        }
+        close(fd);
+        if (file->mapped) return file;
+    }
+#endif
+    // Not mapped, e.g. empty or not a regular file: read it
+    {
+        FILE *in = path ? fopen(path, "rb") : NULL;
+        size_t cap = 4096;
+        if (!in) {
+            *error = "Cannot open file";
+            cron_file_unmap(file);
+            return NULL;
+        }
+        for (;;) {
+            char *grown = (char *) cron_alloc(&file->allocator, cap);
+            if (!grown) {
+                *error = "Out of memory";
+                break;
+            }
+            if (file->data) {
+                memcpy(grown, file->data, file->size);
+                cron_free(&file->allocator, file->data);
+            }
+            file->data = grown;
+            file->size += fread(file->data + file->size, 1, cap - file->size, in);
+            if (file->size < cap) break;
+            cap *= 2;
+        }
+        if (!*error && ferror(in)) {
+            *error = "Cannot read file";
+        }
+        fclose(in);
+        if (*error) {
+            cron_file_unmap(file);
+            return NULL;
+        }
+    }
+    return file;
+}
+
+const char *cron_file_data(const cron_file *file) {
+    return file ? file->data : NULL;
+}
+
+size_t cron_file_size(const cron_file *file) {
+    return file ? file->size : 0;
+}
+
+void cron_file_unmap(cron_file *file) {
+    if (!file) return;
+#ifdef CRON_USE_MMAP
+    if (file->mapped) {
+        munmap(file->data, file->size);
+    } else
+#endif
+    {
+        cron_free(&file->allocator, file->data);
+    }
+    cron_free(&file->allocator, file);
+}
+
+struct cron_crontab {
+    cron_crontab_entry *entries;
+    uint64_t *hashes; /* hash of the text of each entry */
+    size_t count;
+    cron_allocator allocator;
+};
+
+static const char *const CRON_MACROS[][2] = {
+        {"@yearly",   "0 0 0 1 1 *"},
+        {"@annually", "0 0 0 1 1 *"},
+        {"@monthly",  "0 0 0 1 * *"},
+        {"@weekly",   "0 0 0 * * 0"},
+        {"@daily",    "0 0 0 * * *"},
+        {"@midnight", "0 0 0 * * *"},
+        {"@hourly",   "0 0 * * * *"}
+};
+#define CRON_MACROS_LEN (sizeof(CRON_MACROS) / sizeof(CRON_MACROS[0]))
+
+/** Check if a crontab line sets an environment variable, 'NAME=value' */
+static int is_env_line(const char *line, size_t len) {
+    size_t i = 0;
+    if (!isalpha((unsigned char) line[0]) && '_' != line[0]) return 0;
+    while (i < len && (isalnum((unsigned char) line[i]) || '_' == line[i])) i++;
+    while (i < len && (' ' == line[i] || '\t' == line[i])) i++;
+    return i < len && '=' == line[i];
+}
+
+/** Parse the expression of a crontab entry from its text: a macro, 6 fields if they are valid, or 5 fields */
+static void crontab_parse(cron_crontab_entry *entry) {
+    char buf[CRON_MAX_STR_LEN_TO_SPLIT];
+    const char *text = entry->text;
+    size_t len = strlen(text);
+    size_t end = 0;
+    size_t i;
+    if ('@' == text[0]) {
+        while (end < len && !isspace((unsigned char) text[end])) end++;
+        memset(&entry->expr, 0, sizeof(cron_expr));
+        entry->error = "Unknown macro";
+        for (i = 0; i < CRON_MACROS_LEN; i++) {
+            if (strlen(CRON_MACROS[i][0]) == end && 0 == strncmp(text, CRON_MACROS[i][0], end)) {
+                cron_parse_expr(CRON_MACROS[i][1], &entry->expr, &entry->error);
+                break;
+            }
+        }
+    } else {
+        end = copy_fields(text, len, 6, buf, sizeof(buf));
+        entry->error = "Expression too long";
+        if (end <= len) cron_parse_expr(buf, &entry->expr, &entry->error);
+        if (entry->error) {
+            // Standard crontab fields, firing at second 0
+            strcpy(buf, "0 ");
+            end = copy_fields(text, len, 5, buf + 2, sizeof(buf) - 2);
+            if (end <= len) {
+                cron_parse_expr(buf, &entry->expr, &entry->error);
+            } else {
+                end = len;
+            }
+        }
+    }
+    while (end < len && isspace((unsigned char) text[end])) end++;
+    entry->command = text + end;
+}
+
+/** Next line of a text at *pos without surrounding white space, 0 at the end of the text */
+static int next_line(const char *data, size_t len, size_t *pos, const char **line, size_t *line_len) {
+    const char *nl;
+    size_t start = *pos, end;
+    if (start >= len) return 0;
+    nl = (const char *) memchr(data + start, '\n', len - start);
+    end = nl ? (size_t) (nl - data) : len;
+    *pos = end + 1;
+    while (start < end && isspace((unsigned char) data[start])) start++;
+    while (end > start && isspace((unsigned char) data[end - 1])) end--;
+    *line = data + start;
+    *line_len = end - start;
+    return 1;
+}
+
+/** Check if a crontab line holds an entry, not a comment, an environment variable or white space only */
+static int is_entry_line(const char *line, size_t len) {
+    return len > 0 && '#' != line[0] && !is_env_line(line, len);
+}
+
+/** Check if the text of an entry is the line of len chars */
+static int crontab_text_is(const cron_crontab_entry *entry, const char *line, size_t len) {
+    return 0 == strncmp(entry->text, line, len) && '\0' == entry->text[len];
+}
+
+/** Index slot of the entries with hash, index + 1 of each is stored in the slots, 0 for free slots */
+static size_t *index_probe(size_t *slots, size_t mask, uint64_t hash) {
+    size_t i = (size_t) hash & mask;
+    while (slots[i]) i = (i + 1) & mask;
+    return &slots[i];
+}
+
+cron_crontab *cron_crontab_create(void) {
+    cron_crontab *tab = (cron_crontab *) cron_alloc(&cron_current_allocator, sizeof(cron_crontab));
+    if (!tab) return NULL;
+    memset(tab, 0, sizeof(cron_crontab));
+    tab->allocator = cron_current_allocator;
+    return tab;
+}
+
+void cron_crontab_free(cron_crontab *tab) {
+    size_t i;
+    if (!tab) return;
+    for (i = 0; i < tab->count; i++) {
+        cron_free(&tab->allocator, (void *) tab->entries[i].text);
+    }
+    cron_free(&tab->allocator, tab->entries);
+    cron_free(&tab->allocator, tab->hashes);
+    cron_free(&tab->allocator, tab);
+}
+
+size_t cron_crontab_count(const cron_crontab *tab) {
+    return tab ? tab->count : 0;
+}
+
+const cron_crontab_entry *cron_crontab_entries(const cron_crontab *tab) {
+    return tab ? tab->entries : NULL;
+}
+
+int cron_crontab_update(cron_crontab *tab, const char *data, size_t len, cron_crontab_diff_fn diff, void *ctx,
+                        const char **error) {
+    const char *err_local;
+    const cron_allocator *allocator;
+    cron_crontab_entry *entries = NULL;
+    uint64_t *hashes = NULL;
+    uint8_t *state = NULL; /* per old entry: 0 removed, 1 kept, 2 changed; per new entry: 1 if parsed */
+    size_t *slots = NULL;
+    size_t mask = 1;
+    size_t n = 0, k = 0, j, pos = 0, line_len, line_no = 0, next_old = 0;
+    const char *line;
+    int indexed = 0;
+    if (!error) {
+        error = &err_local;
+    }
+    *error = NULL;
+    if (!tab || (!data && len)) {
+        *error = "Invalid crontab";
+        return -1;
+    }
+    allocator = &tab->allocator;
+    while (next_line(data, len, &pos, &line, &line_len)) {
+        if (is_entry_line(line, line_len)) n++;
+    }
+    while (mask + 1 < 2 * (tab->count > n ? tab->count : n)) mask = mask * 2 + 1;
+    if (n) {
+        entries = (cron_crontab_entry *) cron_alloc(allocator, n * sizeof(cron_crontab_entry));
+        hashes = (uint64_t *) cron_alloc(allocator, n * sizeof(uint64_t));
+    }
+    state = (uint8_t *) cron_alloc(allocator, tab->count + n + 1);
+    slots = (size_t *) cron_alloc(allocator, (mask + 1) * sizeof(size_t));
+    if ((n && (!entries || !hashes)) || !state || !slots) {
+        *error = "Out of memory";
+        goto return_error;
+    }
+    memset(state, 0, tab->count + n);
+    memset(slots, 0, (mask + 1) * sizeof(size_t));
+
+    // Entries with the text of an old entry take it over, the other ones are parsed
+    pos = 0;
+    while (next_line(data, len, &pos, &line, &line_len)) {
+        uint64_t hash;
+        size_t i;
+        line_no++;
+        if (!is_entry_line(line, line_len)) continue;
+        hash = hash_bytes(CRON_FNV_OFFSET, line, line_len);
+        hashes[k] = hash;
+        // Most lines follow the same line as before, check the entry after the last one kept first
+        j = next_old;
+        if (j < tab->count && hash == tab->hashes[j] && !state[j] && crontab_text_is(&tab->entries[j], line, line_len)) {
+            i = mask + 1;
+        } else {
+            if (!indexed) {
+                // Index of the old entries by the hash of their text, built once a line has moved
+                for (j = 0; j < tab->count; j++) {
+                    *index_probe(slots, mask, tab->hashes[j]) = j + 1;
+                }
+                indexed = 1;
+            }
+            for (i = (size_t) hash & mask; slots[i]; i = (i + 1) & mask) {
+                j = slots[i] - 1;
+                if (hash == tab->hashes[j] && !state[j] && crontab_text_is(&tab->entries[j], line, line_len)) {
+                    break;
+                }
+            }
+        }
+        if (i > mask || slots[i]) {
+            next_old = j + 1;
+            state[j] = 1;
+            entries[k] = tab->entries[j];
+        } else {
+            char *text = (char *) cron_alloc(allocator, line_len + 1);
+            if (!text) {
+                *error = "Out of memory";
+                goto return_error;
+            }
+            memcpy(text, line, line_len);
+            text[line_len] = '\0';
+            entries[k].text = text;
+            crontab_parse(&entries[k]);
+            state[tab->count + k] = 1;
+        }
+        entries[k].line = line_no;
+        k++;
+    }
 
-    char **fields = split_str(value, ',', &len);
-    if (!fields) {
-        *error = "Comma split error";
-        goto return_result;
+    // An old entry removed and a new one with the same command are reported as changed
+    memset(slots, 0, (mask + 1) * sizeof(size_t));
+    for (j = 0; j < tab->count; j++) {
+        if (!state[j]) {
+            *index_probe(slots, mask, hash_bytes(CRON_FNV_OFFSET, tab->entries[j].command,
+                                                 strlen(tab->entries[j].command))) = j + 1;
+        }
+    }
+    for (k = 0; k < n; k++) {
+        const cron_crontab_entry *old_entry = NULL;
+        size_t i;
+        if (!state[tab->count + k]) continue;
+        i = (size_t) hash_bytes(CRON_FNV_OFFSET, entries[k].command, strlen(entries[k].command)) & mask;
+        for (; slots[i]; i = (i + 1) & mask) {
+            j = slots[i] - 1;
+            if (!state[j] && 0 == strcmp(tab->entries[j].command, entries[k].command)) {
+                state[j] = 2;
+                old_entry = &tab->entries[j];
+                break;
+            }
+        }
+        if (diff) diff(ctx, old_entry ? CRON_CRONTAB_CHANGED : CRON_CRONTAB_ADDED, old_entry, &entries[k]);
+    }
+    for (j = 0; j < tab->count; j++) {
+        if (!state[j] && diff) diff(ctx, CRON_CRONTAB_REMOVED, &tab->entries[j], NULL);
     }
 
-    for (i = 0; i < len; i++) {
-        if (!has_char(fields[i], '/')) {
-            /* Not an incrementer so it must be a range (possibly empty) */
+    for (j = 0; j < tab->count; j++) {
+        if (1 != state[j]) cron_free(allocator, (void *) tab->entries[j].text);
+    }
+    cron_free(allocator, tab->entries);
+    cron_free(allocator, tab->hashes);
+    tab->entries = entries;
+    tab->hashes = hashes;
+    tab->count = n;
+    cron_free(allocator, state);
+    cron_free(allocator, slots);
+    return 0;
+
+    return_error:
+    // The crontab is left as it was
+    for (j = 0; state && j < k; j++) {
+        if (state[tab->count + j]) cron_free(allocator, (void *) entries[j].text);
+    }
+    cron_free(allocator, entries);
+    cron_free(allocator, hashes);
+    cron_free(allocator, state);
+    cron_free(allocator, slots);
+    return -1;
+}
 
-            unsigned int *range = get_range(fields[i], min, max, error);
+int cron_crontab_load(cron_crontab *tab, const char *path, cron_crontab_diff_fn diff, void *ctx,
+                      const char **error) {
+    const char *err_local;
+    cron_file *file;
+    int res;
+    if (!error) {
+        error = &err_local;
+    }
+    file = cron_file_map(path, error);
+    if (!file) return -1;
+    res = cron_crontab_update(tab, cron_file_data(file), cron_file_size(file), diff, ctx, error);
+    cron_file_unmap(file);
+    return res;
+}
 
-            if (*error) {
-                if (range) {
-                    cronFree(range);
-                }
-                goto return_result;
+/** First fire time of an every day expression at or after the second of day sod, -1 if there is none left that day */
+static int every_day_next(const cron_expr *expr, unsigned int sod) {
+    unsigned int hour = sod / 3600;
+    unsigned int minute = sod / 60 % 60;
+    unsigned int second;
+    int notfound = 0;
+    if (cron_getBit(expr->hours, hour)) {
+        if (cron_getBit(expr->minutes, minute)) {
+            second = next_set_bit(expr->seconds, CRON_MAX_SECONDS, sod % 60, &notfound);
+            if (!notfound) return (int) (hour * 3600 + minute * 60 + second);
+            notfound = 0;
+        }
+        minute = next_set_bit(expr->minutes, CRON_MAX_MINUTES, minute + 1, &notfound);
+        if (!notfound) return (int) (hour * 3600 + minute * 60 + next_set_bit(expr->seconds, CRON_MAX_SECONDS, 0, &notfound));
+        notfound = 0;
+    }
+    hour = next_set_bit(expr->hours, CRON_MAX_HOURS, hour + 1, &notfound);
+    if (notfound) return -1;
+    minute = next_set_bit(expr->minutes, CRON_MAX_MINUTES, 0, &notfound);
+    return (int) (hour * 3600 + minute * 60 + next_set_bit(expr->seconds, CRON_MAX_SECONDS, 0, &notfound));
+}
+
+/** Next fire time after date for expressions without day constraints, without a calendar */
+static int64_t kind_next(const cron_expr *expr, int64_t date) {
+    if (CRON_KIND_PERIOD == expr->kind) {
+        int64_t rem = (date - expr->offset) % expr->period;
+        if (rem < 0) rem += expr->period;
+        return date - rem + expr->period;
+    } else {
+        int64_t days = date / CRON_SECONDS_PER_DAY;
+        int64_t sod = date % CRON_SECONDS_PER_DAY;
+        int next;
+        if (sod < 0) {
+            sod += CRON_SECONDS_PER_DAY;
+            days--;
+        }
+        next = sod + 1 < CRON_SECONDS_PER_DAY ? every_day_next(expr, (unsigned int) sod + 1) : -1;
+        if (next < 0) {
+            days++;
+            next = every_day_next(expr, 0);
+        }
+        return days * CRON_SECONDS_PER_DAY + next;
+    }
+}
+
+/**
+ * Next fire time after date searched from the top down: the next month with a matching day, the first matching day
+ * of it, then the first fire time of that day. Only the day of date itself can run out of fire times, moving on to
+ * the next matching day. Months are skipped by the months field and searched over a full 400-year cycle at most.
+ *
+ * @param expr The parsed cron expression.
+ * @param date The time after which the next cron trigger should be found.
+ * @param next_out Set to the next trigger time if successful.
+ * @return Error code: 0 on success, other values (e. g. -1) mean failure.
+ */
+static int civil_next_top_down(const cron_expr *expr, int64_t date, int64_t *next_out) {
+    uint8_t lw_flags = get_lw_flags(expr);
+    cron_civil calendar;
+    int64_t year;
+    unsigned int mon;
+    uint32_t mask;
+    int fire;
+    int res = 0;
+    // Within the calendar, date + 1 can't overflow
+    if (!civil_in_range(date)) return -1;
+    civil_set_seconds(&calendar, date + 1);
+    year = calendar.year;
+    mon = (unsigned int) calendar.mon;
+    // The day of date: matching, with a fire time left
+    mask = civil_month_days(expr, lw_flags, year, mon, &res);
+    if (res) return -1;
+    if (mask >> calendar.mday & 1) {
+        fire = every_day_next(expr, (unsigned int) calendar.sod);
+        if (fire >= 0) {
+            *next_out = calendar.days * CRON_SECONDS_PER_DAY + fire;
+            return civil_in_range(*next_out) ? 0 : -1;
+        }
+    }
+    // The first matching day after it
+    mask &= ~(uint32_t) ((UINT64_C(2) << calendar.mday) - 1);
+    if (!mask && 0 != civil_next_month(expr, lw_flags, &year, &mon, &mask)) return -1;
+    *next_out = (days_from_civil(year, mon + 1, 1) + count_trailing_zeros(mask) - 1) * CRON_SECONDS_PER_DAY +
+                every_day_next(expr, 0);
+    return civil_in_range(*next_out) ? 0 : -1;
+}
+
+/** Last fire time of an every day expression at or before the second of day sod, -1 if there is none that day */
+static int every_day_prev(const cron_expr *expr, unsigned int sod) {
+    unsigned int hour = sod / 3600;
+    unsigned int minute = sod / 60 % 60;
+    unsigned int second;
+    int notfound = 0;
+    if (cron_getBit(expr->hours, hour)) {
+        if (cron_getBit(expr->minutes, minute)) {
+            second = prev_set_bit(expr->seconds, CRON_MAX_SECONDS, sod % 60, &notfound);
+            if (!notfound) return (int) (hour * 3600 + minute * 60 + second);
+            notfound = 0;
+        }
+        minute = 0 == minute ? 0 : prev_set_bit(expr->minutes, CRON_MAX_MINUTES, minute - 1, &notfound);
+        if (minute < sod / 60 % 60 && !notfound) {
+            return (int) (hour * 3600 + minute * 60 +
+                          prev_set_bit(expr->seconds, CRON_MAX_SECONDS, CRON_MAX_SECONDS - 1, &notfound));
+        }
+        notfound = 0;
+    }
+    hour = 0 == hour ? 0 : prev_set_bit(expr->hours, CRON_MAX_HOURS, hour - 1, &notfound);
+    if (notfound || hour >= sod / 3600) return -1;
+    minute = prev_set_bit(expr->minutes, CRON_MAX_MINUTES, CRON_MAX_MINUTES - 1, &notfound);
+    return (int) (hour * 3600 + minute * 60 +
+                  prev_set_bit(expr->seconds, CRON_MAX_SECONDS, CRON_MAX_SECONDS - 1, &notfound));
+}
+
+/**
+ * Counterpart of civil_next_top_down() for the reverse search: the last fire time at or before date.
+ *
+ * @param expr The parsed cron expression.
+ * @param date The time at or before which the previous cron trigger should be found.
+ * @param prev_out Set to the previous trigger time if successful.
+ * @return Error code: 0 on success, other values (e. g. -1) mean failure.
+ */
+static int civil_prev_top_down(const cron_expr *expr, int64_t date, int64_t *prev_out) {
+    uint8_t lw_flags = get_lw_flags(expr);
+    cron_civil calendar;
+    int64_t year;
+    unsigned int mon;
+    uint32_t mask;
+    int fire;
+    int res = 0;
+    if (!civil_in_range(date)) return -1;
+    civil_set_seconds(&calendar, date);
+    year = calendar.year;
+    mon = (unsigned int) calendar.mon;
+    // The day of date: matching, with a fire time up to date
+    mask = civil_month_days(expr, lw_flags, year, mon, &res);
+    if (res) return -1;
+    if (mask >> calendar.mday & 1) {
+        fire = every_day_prev(expr, (unsigned int) calendar.sod);
+        if (fire >= 0) {
+            *prev_out = calendar.days * CRON_SECONDS_PER_DAY + fire;
+            return 0;
+        }
+    }
+    // The last matching day before it
+    mask &= (uint32_t) ((UINT64_C(1) << calendar.mday) - 1);
+    if (!mask && 0 != civil_prev_month(expr, lw_flags, &year, &mon, &mask)) return -1;
+    *prev_out = (days_from_civil(year, mon + 1, 1) + highest_set_bit(mask) - 1) * CRON_SECONDS_PER_DAY +
+                every_day_prev(expr, CRON_SECONDS_PER_DAY - 1);
+    return civil_in_range(*prev_out) ? 0 : -1;
+}
+
+/**
+ * Find the next fire time after date on a timeline without offset changes: UTC, or the wall-clock time of one
+ * UTC offset, in seconds since 1970-01-01 00:00:00.
+ *
+ * @param expr The parsed cron expression.
+ * @param date The time after which the next cron trigger should be found.
+ * @param next_out Set to the next trigger time if successful.
+ * @return Error code: 0 on success, other values (e. g. -1) mean failure.
+ */
+static int civil_next(const cron_expr *expr, int64_t date, int64_t *next_out) {
+    cron_civil calendar;
+    if (CRON_KIND_NEVER == expr->kind) {
+        return -1;
+    }
+    if (CRON_KIND_SPARSE == expr->kind) {
+        return civil_next_top_down(expr, date, next_out);
+    }
+    if (CRON_KIND_GENERAL != expr->kind) {
+        // Within the calendar, a period or day can be added to date without overflow
+        if (!civil_in_range(date)) return -1;
+        *next_out = kind_next(expr, date);
+        return civil_in_range(*next_out) ? 0 : -1;
+    }
+    civil_set_seconds(&calendar, date);
+    if (0 != civil_do_next(expr, &calendar, calendar.year)) return -1;
+    if (civil_seconds(&calendar) == date) {
+        /* We arrived at the original timestamp - round up to the next whole second and try again... */
+        civil_add(&calendar, CRON_CF_SECOND, 1);
+        if (0 != civil_do_next(expr, &calendar, calendar.year)) return -1;
+    }
+    *next_out = civil_seconds(&calendar);
+    return 0;
+}
+
+time_t cron_next(const cron_expr *expr, time_t date) {
+    /*
+     The plan:
+
+     1 Round up to the next whole second
+
+     2 If seconds match move on, otherwise find the next match:
+     2.1 If next match is in the next minute then roll forwards
+
+     3 If minute matches move on, otherwise find the next match
+     3.1 If next match is in the next hour then roll forwards
+     3.2 Reset the seconds and go to 2
+
+     4 If hour matches move on, otherwise find the next match
+     4.1 If next match is in the next day then roll forwards,
+     4.2 Reset the minutes and seconds and go to 2
+
+     ...
+     */
+    if (!expr || CRON_KIND_NEVER == expr->kind) return CRON_INVALID_INSTANT;
+#ifndef CRON_USE_LOCAL_TIME
+    int64_t next;
+    if (0 != civil_next(expr, (int64_t) date, &next)) return CRON_INVALID_INSTANT;
+    if ((int64_t) (time_t) next != next) return CRON_INVALID_INSTANT;
+    return (time_t) next;
+#else /* CRON_USE_LOCAL_TIME */
+    if (local_zone) return cron_next_tz(expr, local_zone, date);
+    if (CRON_KIND_SPARSE == expr->kind) {
+        cron_civil wall;
+        int64_t next;
+        if (civil_init(&wall, date)) return CRON_INVALID_INSTANT;
+        for (;;) {
+            if (0 != civil_next_top_down(expr, civil_seconds(&wall), &next)) return CRON_INVALID_INSTANT;
+            civil_set_seconds(&wall, next);
+            time_t found = civil_to_time_after(&wall, date);
+            if (CRON_INVALID_INSTANT == found || found > date) return found;
+            /* Wall-clock time repeated by a backward DST transition, passed already: search after it */
+        }
+    }
+    struct tm calval;
+    memset(&calval, 0, sizeof(struct tm));
+    struct tm *calendar = cron_time(&date, &calval);
+    if (!calendar) return CRON_INVALID_INSTANT;
+    time_t original = cron_mktime(calendar);
+    if (CRON_INVALID_INSTANT == original) return CRON_INVALID_INSTANT;
+
+    int res = do_next(expr, calendar, calendar->tm_year);
+    if (0 != res) return CRON_INVALID_INSTANT;
+
+    time_t calculated = cron_mktime(calendar);
+    if (CRON_INVALID_INSTANT == calculated) return CRON_INVALID_INSTANT;
+    if (calculated == original) {
+        /* We arrived at the original timestamp - round up to the next whole second and try again... */
+        res = add_to_field(calendar, CRON_CF_SECOND, 1);
+        if (0 != res) return CRON_INVALID_INSTANT;
+        res = do_next(expr, calendar, calendar->tm_year);
+        if (0 != res) return CRON_INVALID_INSTANT;
+    }
+
+    return cron_mktime(calendar);
+#endif /* CRON_USE_LOCAL_TIME */
+}
+
+int cron_next_tm(const cron_expr *expr, const struct tm *in, struct tm *out) {
+    cron_civil calendar;
+    int64_t next;
+    if (!expr || !in || !out) return -1;
+    civil_set_date(&calendar, (int64_t) in->tm_year + 1900, in->tm_mon, in->tm_mday);
+    civil_set_sod(&calendar, (int64_t) in->tm_hour * 3600 + (int64_t) in->tm_min * 60 + in->tm_sec);
+    if (0 != civil_next(expr, civil_seconds(&calendar), &next)) return -1;
+    civil_set_seconds(&calendar, next);
+    memset(out, 0, sizeof(struct tm));
+    out->tm_year = calendar.year - 1900;
+    out->tm_mon = calendar.mon;
+    out->tm_mday = calendar.mday;
+    out->tm_hour = calendar.sod / 3600;
+    out->tm_min = calendar.sod / 60 % 60;
+    out->tm_sec = calendar.sod % 60;
+    out->tm_wday = calendar.wday;
+    out->tm_yday = (int) (calendar.days - days_from_civil(calendar.year, 1, 1));
+    out->tm_isdst = -1;
+    return 0;
+}
+
+time_t cron_prev(const cron_expr *expr, time_t date) {
+    if (!expr || CRON_KIND_NEVER == expr->kind) return CRON_INVALID_INSTANT;
+    cron_civil calendar;
+    if (civil_init(&calendar, date)) return CRON_INVALID_INSTANT;
+    int dot = calendar.year;
+    for (;;) {
+        if (CRON_KIND_SPARSE == expr->kind) {
+            int64_t found;
+            if (0 != civil_prev_top_down(expr, civil_seconds(&calendar), &found)) return CRON_INVALID_INSTANT;
+            civil_set_seconds(&calendar, found);
+        } else if (0 != civil_do_prev(expr, &calendar, dot)) {
+            return CRON_INVALID_INSTANT;
+        }
+        time_t prev = civil_to_time(&calendar);
+        if (calendar.overflow) return CRON_INVALID_INSTANT;
+        if (prev <= date) return prev;
+        /* Local time only: a wall-clock time that doesn't exist (DST gap) was moved past date; search before it */
+        civil_add(&calendar, CRON_CF_SECOND, -1);
+    }
+}
+
+void cron_cursor_init(cron_cursor *cursor, const cron_expr *expr) {
+    if (!cursor) return;
+    memset(cursor, 0, sizeof(*cursor));
+    if (expr) cursor->expr = *expr;
+}
+
+time_t cron_cursor_next(cron_cursor *cursor, time_t date) {
+    if (!cursor) return CRON_INVALID_INSTANT;
+    // No fire time in ]from, next[, so the same next follows any date of [from, next[; none after from at all if
+    // next is invalid
+    if (cursor->cached && date >= cursor->from && (CRON_INVALID_INSTANT == cursor->next || date < cursor->next)) {
+        return cursor->next;
+    }
+    cursor->from = date;
+    cursor->next = cron_next(&cursor->expr, date);
+    cursor->cached = 1;
+    return cursor->next;
+}
+
+void cron_tick_init(const cron_expr *expr, cron_tick_state *state, time_t now) {
+    if (!state) return;
+    state->last = now;
+    state->next = cron_next(expr, now);
+    state->missed = 0;
+}
+
+int cron_due(const cron_expr *expr, cron_tick_state *state, time_t now) {
+    int64_t missed;
+    if (!expr || !state) return 0;
+    if (now < state->next) {
+        state->last = now;
+        return 0;
+    }
+    state->last = now;
+    if (CRON_INVALID_INSTANT == state->next) return 0;
+    // Consume the fire dates of ]last, now]: next and those after it
+    missed = cron_count(expr, state->next, now);
+    state->missed = missed > 0 ? (uint64_t) missed : 0;
+    state->next = cron_next(expr, now);
+    return 1;
+}
+
+int cron_satisfiable(const cron_expr *expr) {
+    return expr && CRON_KIND_NEVER != expr->kind;
+}
+
+void cron_classify(cron_expr *expr) {
+    if (expr) classify_expr(expr);
+}
+
+int cron_matches(const cron_expr *expr, time_t date) {
+    cron_civil calendar;
+    uint8_t lw_flags;
+    uint8_t cur_doms[4];
+    int res = 0;
+    if (!expr) return 0;
+    if (civil_init(&calendar, date)) return 0;
+#ifdef CRON_USE_LOCAL_TIME
+    if (local_zone) {
+        int decided = zone_transition_match(expr, local_zone, (int64_t) date);
+        if (decided >= 0) return decided;
+    }
+#endif /* CRON_USE_LOCAL_TIME */
+    if (!cron_getBit(expr->seconds, calendar.sod % 60) || !cron_getBit(expr->minutes, calendar.sod / 60 % 60) ||
+        !cron_getBit(expr->hours, calendar.sod / 3600) || !cron_getBit(expr->months, calendar.mon) ||
+        !cron_getBit(expr->days_of_week, calendar.wday)) {
+        return 0;
+    }
+    lw_flags = get_lw_flags(expr);
+    if (!lw_flags) {
+        return cron_getBit(expr->days_of_month, calendar.mday);
+    }
+    // Resolve the L/W flags for the month of date only
+    memcpy(cur_doms, expr->days_of_month, 4);
+    civil_lw_days(expr, calendar.days - (calendar.mday - 1), days_in_month(calendar.year, calendar.mon + 1), lw_flags,
+                  cur_doms, &res);
+    if (res) return 0;
+    return cron_getBit(cur_doms, calendar.mday);
+}
+
+/*
+ * Expression table
+ *
+ * The table is bit-sliced: for each value of each field there is one row with one bit per expression, set if the
+ * expression allows that value. L/W flags get rows of their own, by L offset, W day and last day of week. Matching
+ * an instant ORs the few rows which can select its day of month and ANDs the result with the rows of its other
+ * field values, reading about CRON_TABLE_ROWS / 8 bytes per expression in total.
+ */
+
+#define CRON_TABLE_ROW_SECOND 0
+#define CRON_TABLE_ROW_MINUTE (CRON_TABLE_ROW_SECOND + CRON_MAX_SECONDS)
+#define CRON_TABLE_ROW_HOUR (CRON_TABLE_ROW_MINUTE + CRON_MAX_MINUTES)
+#define CRON_TABLE_ROW_DAY_OF_MONTH (CRON_TABLE_ROW_HOUR + CRON_MAX_HOURS)
+#define CRON_TABLE_ROW_MONTH (CRON_TABLE_ROW_DAY_OF_MONTH + CRON_MAX_DAYS_OF_MONTH)
+#define CRON_TABLE_ROW_DAY_OF_WEEK (CRON_TABLE_ROW_MONTH + CRON_MAX_MONTHS - 1)
+#define CRON_TABLE_ROW_L_OFFSET (CRON_TABLE_ROW_DAY_OF_WEEK + CRON_MAX_DAYS_OF_WEEK - 1) /* 'L-x' in day of month */
+#define CRON_TABLE_ROW_W_DAY (CRON_TABLE_ROW_L_OFFSET + CRON_MAX_DAYS_OF_MONTH - 1) /* 'xW', 'LW' at 0 */
+#define CRON_TABLE_ROW_L_DAY_OF_WEEK (CRON_TABLE_ROW_W_DAY + CRON_MAX_DAYS_OF_MONTH) /* 'xL' in day of week */
+#define CRON_TABLE_ROWS (CRON_TABLE_ROW_L_DAY_OF_WEEK + CRON_MAX_DAYS_OF_WEEK - 1)
+
+/* Rows ORed for the day of month of an instant: day of month, L offset, last day of week and up to 4 W flags
+ * (a Friday at the end of the month is selected by itself, the next two days and 'LW') */
+#define CRON_TABLE_MAX_DAY_ROWS 7
+
+struct cron_table {
+    size_t count; /* number of expressions */
+    size_t words; /* 64 bit words per row, a multiple of 4 */
+    uint64_t *rows; /* CRON_TABLE_ROWS rows of words each */
+    size_t slow_count; /* number of expressions checked with cron_matches() */
+    size_t *slow_indices; /* their indices */
+    cron_expr *slow_exprs; /* and copies of them */
+    cron_allocator allocator; /* allocator of the table */
+};
+
+/** Set the bit of expression index in the rows for the set bits [0:max[ of bits */
+static void table_set_bits(cron_table *table, unsigned int row, const uint8_t *bits, unsigned int max, size_t index) {
+    uint64_t word = load_bits(bits, max);
+    while (word) {
+        table->rows[(row + count_trailing_zeros(word)) * table->words + index / 64] |= UINT64_C(1) << (index % 64);
+        word &= word - 1;
+    }
+}
+
+/** Check if the L offsets of an expression may reach before the 1st of a month, then the 1st is selected */
+static int table_needs_slow(const cron_expr *expr) {
+    int notfound = 0;
+    unsigned int offset;
+    if (!(get_lw_flags(expr) & L_DOM_FLAG)) return 0;
+    offset = next_set_bit(expr->l_dom_offset, CRON_MAX_DAYS_OF_MONTH, 0, &notfound);
+    return !notfound && offset >= 28;
+}
+
+cron_table *cron_table_create(const cron_expr *exprs, size_t n) {
+    return cron_table_create_ex(exprs, n, NULL);
+}
 
+cron_table *cron_table_create_ex(const cron_expr *exprs, size_t n, const cron_allocator *allocator) {
+    size_t words = (n + 255) / 256 * 4;
+    size_t slow_count = 0;
+    size_t i;
+    cron_table *table;
+    if (!exprs && n) return NULL;
+    for (i = 0; i < n; i++) {
+        if (table_needs_slow(&exprs[i])) slow_count++;
+    }
+    allocator = call_allocator(allocator);
+    table = (cron_table *) cron_alloc(allocator, sizeof(cron_table) + CRON_TABLE_ROWS * words * sizeof(uint64_t) +
+                                                 slow_count * (sizeof(size_t) + sizeof(cron_expr)));
+    if (!table) return NULL;
+    table->allocator = *allocator;
+    table->count = n;
+    table->words = words;
+    table->rows = (uint64_t *) (table + 1);
+    table->slow_count = 0;
+    table->slow_indices = (size_t *) (table->rows + CRON_TABLE_ROWS * words);
+    table->slow_exprs = (cron_expr *) (table->slow_indices + slow_count);
+    memset(table->rows, 0, CRON_TABLE_ROWS * words * sizeof(uint64_t));
+    for (i = 0; i < n; i++) {
+        const cron_expr *expr = &exprs[i];
+        uint8_t lw_flags = get_lw_flags(expr);
+        int notfound = 0;
+        if (table_needs_slow(expr)) {
+            table->slow_exprs[table->slow_count] = *expr;
+            table->slow_indices[table->slow_count++] = i;
+            continue;
+        }
+        table_set_bits(table, CRON_TABLE_ROW_SECOND, expr->seconds, CRON_MAX_SECONDS, i);
+        table_set_bits(table, CRON_TABLE_ROW_MINUTE, expr->minutes, CRON_MAX_MINUTES, i);
+        table_set_bits(table, CRON_TABLE_ROW_HOUR, expr->hours, CRON_MAX_HOURS, i);
+        table_set_bits(table, CRON_TABLE_ROW_MONTH, expr->months, CRON_MAX_MONTHS - 1, i);
+        table_set_bits(table, CRON_TABLE_ROW_DAY_OF_WEEK, expr->days_of_week, CRON_MAX_DAYS_OF_WEEK - 1, i);
+        if (lw_flags & L_DOW_FLAG) {
+            // Only the first last day of week is used, and it replaces the days of month; see civil_lw_days()
+            unsigned int wday = next_set_bit(expr->l_dow_flags, CRON_MAX_DAYS_OF_WEEK, 0, &notfound);
+            if (!notfound) {
+                table->rows[(CRON_TABLE_ROW_L_DAY_OF_WEEK + wday) * words + i / 64] |= UINT64_C(1) << (i % 64);
             }
+        } else {
+            table_set_bits(table, CRON_TABLE_ROW_DAY_OF_MONTH, expr->days_of_month, CRON_MAX_DAYS_OF_MONTH, i);
+        }
+        if (lw_flags & L_DOM_FLAG) {
+            table_set_bits(table, CRON_TABLE_ROW_L_OFFSET, expr->l_dom_offset, CRON_MAX_DAYS_OF_MONTH - 1, i);
+        }
+        table_set_bits(table, CRON_TABLE_ROW_W_DAY, expr->w_flags, CRON_MAX_DAYS_OF_MONTH, i);
+    }
+    return table;
+}
+
+void cron_table_free(cron_table *table) {
+    if (table) cron_free(&table->allocator, table);
+}
+
+size_t cron_table_count(const cron_table *table) {
+    return table ? table->count : 0;
+}
+
+size_t cron_table_match(const cron_table *table, time_t date, uint64_t *bitmap) {
+    cron_civil calendar;
+    const uint64_t *and_rows[5];
+    const uint64_t *day_rows[CRON_TABLE_MAX_DAY_ROWS];
+    unsigned int n_day_rows = 0;
+    unsigned int lastday, flag, j;
+    int64_t first;
+    size_t words, w = 0;
+    size_t count = 0;
+    size_t i;
+    if (!table || !bitmap) return 0;
+    words = (table->count + 63) / 64;
+    if (civil_init(&calendar, date)) {
+        memset(bitmap, 0, words * sizeof(uint64_t));
+        return 0;
+    }
+    and_rows[0] = table->rows + (CRON_TABLE_ROW_SECOND + calendar.sod % 60) * table->words;
+    and_rows[1] = table->rows + (CRON_TABLE_ROW_MINUTE + calendar.sod / 60 % 60) * table->words;
+    and_rows[2] = table->rows + (CRON_TABLE_ROW_HOUR + calendar.sod / 3600) * table->words;
+    and_rows[3] = table->rows + (CRON_TABLE_ROW_MONTH + calendar.mon) * table->words;
+    and_rows[4] = table->rows + (CRON_TABLE_ROW_DAY_OF_WEEK + calendar.wday) * table->words;
+    // Rows of the flags selecting this day of month in this month
+    first = calendar.days - (calendar.mday - 1);
+    lastday = days_in_month(calendar.year, calendar.mon + 1);
+    day_rows[n_day_rows++] = table->rows + (CRON_TABLE_ROW_DAY_OF_MONTH + calendar.mday) * table->words;
+    day_rows[n_day_rows++] = table->rows + (CRON_TABLE_ROW_L_OFFSET + lastday - calendar.mday) * table->words;
+    if (calendar.mday + 7 > (int) lastday) {
+        day_rows[n_day_rows++] = table->rows + (CRON_TABLE_ROW_L_DAY_OF_WEEK + calendar.wday) * table->words;
+    }
+    for (flag = 0; flag <= lastday && n_day_rows < CRON_TABLE_MAX_DAY_ROWS; flag++) {
+        if (civil_w_day(first, lastday, flag) == (unsigned int) calendar.mday) {
+            day_rows[n_day_rows++] = table->rows + (CRON_TABLE_ROW_W_DAY + flag) * table->words;
+        }
+    }
+#if defined(__AVX2__)
+    for (; w + 4 <= words; w += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (day_rows[0] + w));
+        for (j = 1; j < n_day_rows; j++) {
+            v = _mm256_or_si256(v, _mm256_loadu_si256((const __m256i *) (day_rows[j] + w)));
+        }
+        for (j = 0; j < 5; j++) {
+            v = _mm256_and_si256(v, _mm256_loadu_si256((const __m256i *) (and_rows[j] + w)));
+        }
+        _mm256_storeu_si256((__m256i *) (bitmap + w), v);
+    }
+#elif defined(CRON_USE_SSE2)
+    for (; w + 2 <= words; w += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (day_rows[0] + w));
+        for (j = 1; j < n_day_rows; j++) {
+            v = _mm_or_si128(v, _mm_loadu_si128((const __m128i *) (day_rows[j] + w)));
+        }
+        for (j = 0; j < 5; j++) {
+            v = _mm_and_si128(v, _mm_loadu_si128((const __m128i *) (and_rows[j] + w)));
+        }
+        _mm_storeu_si128((__m128i *) (bitmap + w), v);
+    }
+#endif
+    for (; w < words; w++) {
+        uint64_t v = day_rows[0][w];
+        for (j = 1; j < n_day_rows; j++) {
+            v |= day_rows[j][w];
+        }
+        for (j = 0; j < 5; j++) {
+            v &= and_rows[j][w];
+        }
+        bitmap[w] = v;
+    }
+    for (i = 0; i < table->slow_count; i++) {
+        if (cron_matches(&table->slow_exprs[i], date)) {
+            bitmap[table->slow_indices[i] / 64] |= UINT64_C(1) << (table->slow_indices[i] % 64);
+        }
+    }
+    for (w = 0; w < words; w++) {
+        count += count_set_bits(bitmap[w]);
+    }
+    return count;
+}
+
+typedef struct {
+    const cron_expr *exprs;
+    size_t n;
+    time_t from;
+    time_t *out;
+} cron_batch_chunk;
+
+static void batch_run(const cron_batch_chunk *chunk) {
+    size_t i;
+    for (i = 0; i < chunk->n; i++) {
+        chunk->out[i] = cron_next(&chunk->exprs[i], chunk->from);
+    }
+}
+
+#ifdef CRON_USE_THREADS
+
+static void *batch_thread(void *arg) {
+    batch_run((const cron_batch_chunk *) arg);
+    return NULL;
+}
+
+#endif /* CRON_USE_THREADS */
+
+void cron_next_batch(const cron_expr *exprs, size_t n, time_t from, time_t *out, unsigned int threads) {
+    cron_batch_chunk chunks[CRON_BATCH_MAX_THREADS];
+#ifdef CRON_USE_THREADS
+    pthread_t ids[CRON_BATCH_MAX_THREADS];
+    int started[CRON_BATCH_MAX_THREADS];
+#endif
+    size_t i, start, end;
+    if (!exprs || !out || 0 == n) return;
+#ifdef CRON_USE_THREADS
+    if (0 == threads) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned int) cpus : 1;
+    }
+#else
+    threads = 1;
+#endif
+    if (threads > CRON_BATCH_MAX_THREADS) threads = CRON_BATCH_MAX_THREADS;
+    // Starting a thread costs about as much as a few hundred cron_next calls
+    if (threads > (n + CRON_BATCH_MIN_CHUNK - 1) / CRON_BATCH_MIN_CHUNK) {
+        threads = (unsigned int) ((n + CRON_BATCH_MIN_CHUNK - 1) / CRON_BATCH_MIN_CHUNK);
+    }
+    // Equal contiguous chunks, each written by one thread only
+    for (i = 0; i < threads; i++) {
+        start = n / threads * i + (i < n % threads ? i : n % threads);
+        end = start + n / threads + (i < n % threads ? 1 : 0);
+        chunks[i].exprs = exprs + start;
+        chunks[i].n = end - start;
+        chunks[i].from = from;
+        chunks[i].out = out + start;
+    }
+#ifdef CRON_USE_THREADS
+    for (i = 1; i < threads; i++) {
+        started[i] = 0 == pthread_create(&ids[i], NULL, batch_thread, &chunks[i]);
+    }
+#endif
+    batch_run(&chunks[0]);
+#ifdef CRON_USE_THREADS
+    for (i = 1; i < threads; i++) {
+        if (started[i]) {
+            pthread_join(ids[i], NULL);
+        } else {
+            // Thread could not be started, compute its chunk here
+            batch_run(&chunks[i]);
+        }
+    }
+#endif
+}
+
+#ifdef CRON_USE_LOCAL_TIME
+
+size_t cron_fill_range(const cron_expr *expr, time_t from, time_t to, time_t *out, size_t cap) {
+    size_t count = 0;
+    if (!expr || !out) return 0;
+    /* Wall-clock days don't map linearly to time_t in local time, step with cron_next() */
+    time_t next = cron_next(expr, from);
+    while (count < cap && CRON_INVALID_INSTANT != next && next <= to) {
+        out[count++] = next;
+        next = cron_next(expr, next);
+    }
+    return count;
+}
+
+int64_t cron_count(const cron_expr *expr, time_t from, time_t to) {
+    int64_t count = 0;
+    if (!expr) return -1;
+    time_t next = cron_next(expr, from);
+    while (CRON_INVALID_INSTANT != next && next <= to) {
+        count++;
+        next = cron_next(expr, next);
+    }
+    return count;
+}
+
+time_t cron_nth(const cron_expr *expr, time_t from, uint64_t k) {
+    if (!expr || 0 == k) return CRON_INVALID_INSTANT;
+    while (k-- && CRON_INVALID_INSTANT != from) {
+        from = cron_next(expr, from);
+    }
+    return from;
+}
+
+size_t cron_stream_match(const cron_expr *expr, const time_t *dates, size_t n, uint8_t *matches, time_t *nexts) {
+    size_t count = 0;
+    size_t i;
+    time_t anchor = 0;
+    time_t next = CRON_INVALID_INSTANT;
+    int anchor_match = 0;
+    int cached = 0;
+    if (!expr || !dates) return 0;
+    for (i = 0; i < n; i++) {
+        time_t date = dates[i];
+        int match;
+        if (!cached || date < anchor || (CRON_INVALID_INSTANT != next && date >= next)) {
+            anchor = date;
+            anchor_match = cron_matches(expr, date);
+            next = cron_next(expr, date);
+            cached = 1;
+        }
+        match = date == anchor && anchor_match;
+        count += (size_t) match;
+        if (matches) matches[i] = (uint8_t) match;
+        if (nexts) nexts[i] = next;
+    }
+    return count;
+}
 
-            for (i1 = range[0]; i1 <= range[1]; i1++) {
-                cron_setBit(target, i1);
+#else /* CRON_USE_LOCAL_TIME */
 
-            }
-            cronFree(range);
+/** Write the positions of the set bits [0:max[ of bits in ascending order to positions, return their count. */
+static unsigned int list_set_bits(const uint8_t *bits, unsigned int max, uint8_t *positions) {
+    uint64_t word = load_bits(bits, max);
+    unsigned int count = 0;
+    while (word) {
+        positions[count++] = (uint8_t) count_trailing_zeros(word);
+        word &= word - 1;
+    }
+    return count;
+}
 
-        } else {
-            size_t len2 = 0;
-            char **split = split_str(fields[i], '/', &len2);
-            if (len2 != 2) {
-                *error = "Incrementer doesn't have two fields";
-                free_splitted(split, len2);
-                goto return_result;
-            }
-            unsigned int *range = get_range(split[0], min, max, error);
-            if (*error) {
-                if (range) {
-                    cronFree(range);
+size_t cron_fill_range(const cron_expr *expr, time_t from, time_t to, time_t *out, size_t cap) {
+    size_t count = 0;
+    if (!expr || !out) return 0;
+    time_t next = cron_next(expr, from);
+    uint8_t seconds[CRON_MAX_SECONDS];
+    uint8_t minutes[CRON_MAX_MINUTES];
+    uint8_t hours[CRON_MAX_HOURS];
+    unsigned int n_seconds = list_set_bits(expr->seconds, CRON_MAX_SECONDS, seconds);
+    unsigned int n_minutes = list_set_bits(expr->minutes, CRON_MAX_MINUTES, minutes);
+    unsigned int n_hours = list_set_bits(expr->hours, CRON_MAX_HOURS, hours);
+    uint8_t lw_flags = get_lw_flags(expr);
+    cron_month_doms cur_doms;
+    int64_t lo = next;
+    int64_t hi = to;
+    unsigned int h, m, i;
+    int res = 0;
+    cron_civil calendar;
+
+    if (CRON_INVALID_INSTANT == next || next > to) return 0;
+    cur_doms.month = CRON_MONTH_UNRESOLVED;
+    civil_init(&calendar, next);
+    while (count < cap) {
+        int64_t base = calendar.days * CRON_SECONDS_PER_DAY;
+        if (base > hi) break;
+        // Resolve the days of month (with L/W flags) once per month, then check each day against them
+        civil_month_doms(expr, &calendar, lw_flags, &cur_doms, &res);
+        if (res) break;
+        if (!cron_getBit(expr->months, calendar.mon) || !cron_getBit(cur_doms.doms, calendar.mday) ||
+            !cron_getBit(expr->days_of_week, calendar.wday)) {
+            // Skip to the next matching day
+            next = cron_next(expr, (time_t) (base - 1));
+            if (CRON_INVALID_INSTANT == next || next > to) break;
+            lo = next;
+            civil_init(&calendar, next);
+            continue;
+        }
+        // Enumerate hours, minutes and seconds of the day
+        for (h = 0; h < n_hours; h++) {
+            for (m = 0; m < n_minutes; m++) {
+                int64_t minute = base + hours[h] * 3600 + minutes[m] * 60;
+                if (minute > hi) goto return_count;
+                if (minute + 59 < lo) continue;
+                if (minute >= lo && minute + 59 <= hi && cap - count >= n_seconds) {
+                    for (i = 0; i < n_seconds; i++) {
+                        out[count + i] = (time_t) (minute + seconds[i]);
+                    }
+                    count += n_seconds;
+                    continue;
+                }
+                for (i = 0; i < n_seconds; i++) {
+                    int64_t t = minute + seconds[i];
+                    if (t < lo) continue;
+                    if (t > hi || count == cap) goto return_count;
+                    out[count++] = (time_t) t;
                 }
-                free_splitted(split, len2);
-                goto return_result;
-            }
-            if (!has_char(split[0], '-')) {
-                range[1] = max - 1;
-            }
-            int err = 0;
-            unsigned int delta = parse_uint(split[1], &err);
-            if (err) {
-                *error = "Unsigned integer parse error 4";
-                cronFree(range);
-                free_splitted(split, len2);
-                goto return_result;
-            }
-            if (delta >= max) {
-                *error = "Incrementer too big";
-                cronFree(range);
-                free_splitted(split, len2);
-                goto return_result;
-            }
-            for (i1 = range[0]; i1 <= range[1]; i1 += delta) {
-                cron_setBit(target, i1);
             }
-            free_splitted(split, len2);
-            cronFree(range);
-
         }
+        civil_set_days(&calendar, calendar.days + 1);
     }
-    goto return_result;
-
-    return_result:
-    free_splitted(fields, len);
 
+    return_count:
+    return count;
 }
 
-static char *replace_h_entry(char *field, unsigned int pos, unsigned int min, const char **error) {
-    char *has_h = strchr(field, 'H');
-    if (has_h == NULL) {
-        return field;
+/** Position of the set bit with (0-based) index k in word */
+static unsigned int select_set_bit(uint64_t word, uint64_t k) {
+    while (k--) {
+        word &= word - 1;
     }
+    return count_trailing_zeros(word);
+}
 
-    unsigned int fieldMax = 0, customMax = 0;
-    // minBuf is 0xFF to see if it has been altered/read successfully, since 0 is a valid value for it
-    unsigned int minBuf = 0xFF, maxBuf = 0;
+/** Time of day fields of an expression, to count and select the fire times within a matching day */
+typedef struct {
+    uint64_t seconds;
+    uint64_t minutes;
+    uint64_t hours;
+    unsigned int n_seconds;
+    unsigned int n_minutes;
+    uint64_t per_day; /* fire times of a matching day */
+} cron_day_fields;
+
+static void day_fields_init(cron_day_fields *fields, const cron_expr *expr) {
+    fields->seconds = load_bits(expr->seconds, CRON_MAX_SECONDS);
+    fields->minutes = load_bits(expr->minutes, CRON_MAX_MINUTES);
+    fields->hours = load_bits(expr->hours, CRON_MAX_HOURS);
+    fields->n_seconds = count_set_bits(fields->seconds);
+    fields->n_minutes = count_set_bits(fields->minutes);
+    fields->per_day = (uint64_t) count_set_bits(fields->hours) * fields->n_minutes * fields->n_seconds;
+}
 
-    if (*(has_h + 1) == '/') { /* H before an iterator */
-        sscanf(has_h, "H/%2u",
-               &customMax); // get value of iterator, so it will be used as maximum instead of standard maximum for field
-        if (!customMax) { /* iterator might have been specified as an ordinal instead... */
-            *error = "Hashed: Iterator error";
-            return field;
-        }
-    }
-    if ((has_h != field) && (*(has_h - 1) == '/')) { /* H not allowed as iterator */
-        *error = "Hashed: 'H' not allowed as iterator";
-        return field;
-    }
-    if (*(has_h + 1) == '-' || \
-        (has_h != field && *(has_h - 1) == '-')) { // 'H' not starting field, so may be the end of a range
-        *error = "'H' is not allowed for use in ranges";
-        return field;
+/** Number of fire times of a matching day before the second of day sod (0-86400) */
+static uint64_t fires_before(const cron_day_fields *fields, int sod) {
+    unsigned int hour, minute;
+    uint64_t res;
+    if (sod >= CRON_SECONDS_PER_DAY) {
+        return fields->per_day;
     }
-    // Test if custom Range is specified
-    if (*(has_h + 1) == '(') {
-        sscanf(has_h, "H(%2u-%2u)", &minBuf, &maxBuf);
-        if (!maxBuf || \
-                (minBuf == 0xFF) || \
-                (minBuf > maxBuf) || \
-                (minBuf < min) || \
-                // if a customMax is present: Is read maximum bigger than it? (which it shouldn't be)
-            (customMax ? maxBuf > customMax : 0)
-                ) {
-            *error = "'H' custom range error";
-            return field;
+    hour = (unsigned int) sod / 3600;
+    minute = (unsigned int) sod / 60 % 60;
+    res = (uint64_t) count_set_bits(fields->hours & ((UINT64_C(1) << hour) - 1)) * fields->n_minutes *
+          fields->n_seconds;
+    if (fields->hours >> hour & 1) {
+        res += (uint64_t) count_set_bits(fields->minutes & ((UINT64_C(1) << minute) - 1)) * fields->n_seconds;
+        if (fields->minutes >> minute & 1) {
+            res += count_set_bits(fields->seconds & ((UINT64_C(1) << (sod % 60)) - 1));
         }
-        min = minBuf;
-        // maxBuf needs to be incremented by 1 to include it
-        customMax = maxBuf + 1;
-    }
-    switch (pos) {
-        case CRON_FIELD_SECOND:
-            fieldMax = CRON_MAX_SECONDS;
-            break;
-        case CRON_FIELD_MINUTE:
-            fieldMax = CRON_MAX_MINUTES;
-            break;
-        case CRON_FIELD_HOUR:
-            fieldMax = CRON_MAX_HOURS;
-            break;
-        case CRON_FIELD_DAY_OF_MONTH:
-            // limited to 28th so the hashed cron will be executed every month
-            fieldMax = 28;
-            break;
-        case CRON_FIELD_MONTH:
-            fieldMax = CRON_MAX_MONTHS;
-            break;
-        case CRON_FIELD_DAY_OF_WEEK:
-            fieldMax = CRON_MAX_DAYS_OF_WEEK;
-            break;
-        default:
-            *error = "Unknown field!";
-            return field;
     }
-    if (!customMax) {
-        customMax = fieldMax;
-    } else if (customMax > fieldMax) {
-        *error = "'H' range maximum error";
-        return field;
-    }
-    field = replace_hashed(field, pos, min, customMax, fn, error);
-
-    return field;
+    return res;
 }
 
-static char *check_and_replace_h(char *field, unsigned int pos, unsigned int min, const char **error) {
-    char *has_h = strchr(field, 'H');
+/** Second of day of the fire time with (0-based) index j of a matching day */
+static int select_fire(const cron_day_fields *fields, uint64_t j) {
+    uint64_t per_hour = (uint64_t) fields->n_minutes * fields->n_seconds;
+    unsigned int hour = select_set_bit(fields->hours, j / per_hour);
+    unsigned int minute = select_set_bit(fields->minutes, j % per_hour / fields->n_seconds);
+    unsigned int second = select_set_bit(fields->seconds, j % fields->n_seconds);
+    return (int) (hour * 3600 + minute * 60 + second);
+}
 
-    if (!has_h) {
-        return field;
+int64_t cron_count(const cron_expr *expr, time_t from, time_t to) {
+    cron_day_fields fields;
+    cron_civil start;
+    cron_civil end;
+    uint8_t lw_flags;
+    int64_t year;
+    unsigned int mon;
+    uint64_t mask;
+    int64_t count = 0;
+    int res = 0;
+    if (!expr) return -1;
+    if (to <= from || CRON_KIND_NEVER == expr->kind) return 0;
+    day_fields_init(&fields, expr);
+    if (0 == fields.per_day) return 0;
+    lw_flags = get_lw_flags(expr);
+    // Both ends within the calendar, so the months from start on reach the one of end
+    if (civil_init(&start, (time_t) ((int64_t) from + 1)) || civil_init(&end, to)) return -1;
+    // Whole matching days of each month times the fire times per day, minus the parts of the first and last day
+    // outside of the interval
+    year = start.year;
+    mon = (unsigned int) start.mon;
+    for (;;) {
+        mask = civil_month_days(expr, lw_flags, year, mon, &res);
+        if (res) return -1;
+        if (year == start.year && mon == (unsigned int) start.mon) {
+            mask &= ~((UINT64_C(1) << start.mday) - 1);
+            if (mask >> start.mday & 1) {
+                count -= (int64_t) fires_before(&fields, start.sod);
+            }
+        }
+        if (year == end.year && mon == (unsigned int) end.mon) {
+            mask &= (UINT64_C(2) << end.mday) - 1;
+            if (mask >> end.mday & 1) {
+                count -= (int64_t) (fields.per_day - fires_before(&fields, end.sod + 1));
+            }
+            return count + (int64_t) (count_set_bits(mask) * fields.per_day);
+        }
+        count += (int64_t) (count_set_bits(mask) * fields.per_day);
+        if (++mon == 12) {
+            mon = 0;
+            year++;
+        }
     }
+}
 
-    char *accum_field = NULL;
-    char **subfields = NULL;
-    size_t subfields_len = 0;
-    // Check if Field contains ',', if so, split into multiple subfields, and replace in each (with same position no)
-    char *has_comma = strchr(field, ',');
-    if (has_comma) {
-        // Iterate over split sub-fields, check for 'H' and replace if present
-        subfields = split_str(field, ',', &subfields_len);
-        if (subfields == NULL) {
-            *error = "Failed to split 'H' string in list";
-            goto return_error;
-        }
-        size_t res_len = 0;
-        size_t res_lens[subfields_len];
-        for (size_t i = 0; i < subfields_len; i++) {
-            has_h = strchr(subfields[i], 'H');
-            if (has_h) {
-                subfields[i] = replace_h_entry(subfields[i], pos, min, error);
+time_t cron_nth(const cron_expr *expr, time_t from, uint64_t k) {
+    cron_day_fields fields;
+    cron_civil start;
+    uint8_t lw_flags;
+    int64_t year;
+    unsigned int mon;
+    unsigned int empty_months = 0;
+    int res = 0;
+    if (!expr || 0 == k || CRON_KIND_NEVER == expr->kind) return CRON_INVALID_INSTANT;
+    day_fields_init(&fields, expr);
+    if (0 == fields.per_day) return CRON_INVALID_INSTANT;
+    lw_flags = get_lw_flags(expr);
+    if ((int64_t) from == INT64_MAX || civil_init(&start, (time_t) ((int64_t) from + 1))) return CRON_INVALID_INSTANT;
+    // Skip whole months by their number of fire times, then days, then select the fire time within the day
+    year = start.year;
+    mon = (unsigned int) start.mon;
+    for (;;) {
+        uint64_t mask = civil_month_days(expr, lw_flags, year, mon, &res);
+        uint64_t skipped = 0; // fire times of the start day before the start time
+        uint64_t available;
+        if (res) return CRON_INVALID_INSTANT;
+        if (year == start.year && mon == (unsigned int) start.mon) {
+            mask &= ~((UINT64_C(1) << start.mday) - 1);
+            if (mask >> start.mday & 1) {
+                skipped = fires_before(&fields, start.sod);
             }
-            if (*error != NULL) {
-                goto return_error;
+        }
+        available = count_set_bits(mask) * fields.per_day - skipped;
+        if (available >= k) {
+            while (mask) {
+                unsigned int day = count_trailing_zeros(mask);
+                uint64_t before = day == (unsigned int) start.mday ? skipped : 0;
+                mask &= mask - 1;
+                if (fields.per_day - before >= k) {
+                    int64_t res_time = days_from_civil(year, mon + 1, day) * CRON_SECONDS_PER_DAY +
+                                       select_fire(&fields, before + k - 1);
+                    if ((int64_t) (time_t) res_time != res_time) return CRON_INVALID_INSTANT;
+                    return (time_t) res_time;
+                }
+                k -= fields.per_day - before;
             }
-            res_lens[i] = strnlen(subfields[i], CRON_MAX_STR_LEN_TO_SPLIT);
-            res_len += res_lens[i];
         }
-        // Allocate space for the full string: Result lengths + (result count - 1) for the commas + 1 for '\0'
-        accum_field = (char *) cronMalloc(res_len + subfields_len);
-        if (accum_field == NULL) {
-            *error = "Failed to merge 'H' in list";
-            goto return_error;
+        k -= available;
+        // Give up after a full cycle of the calendar without a fire time
+        empty_months = available ? 0 : empty_months + 1;
+        if (empty_months > CRON_CYCLE_MONTHS) return CRON_INVALID_INSTANT;
+        if (++mon == 12) {
+            mon = 0;
+            // Fire times after the years of the calendar can't be represented
+            if (++year > INT_MAX) return CRON_INVALID_INSTANT;
         }
-        memset(accum_field, 0, res_len + subfields_len);
-        char *tracking = accum_field;
-        for (size_t i = 0; i < subfields_len; i++) {
-            // Sanity check: Is "tracking" still in the allocated memory boundaries?
-            if ((tracking - accum_field) > (res_len + subfields_len)) {
-                *error = "Failed to insert subfields to merged fields: String went oob";
-                goto return_error;
+    }
+}
+
+/** Month of the dates seen by cron_stream_match(), with its matching days */
+typedef struct {
+    int64_t first; /* days since 1970-01-01 of the 1st of the month */
+    int64_t end; /* days since 1970-01-01 of the 1st of the next month */
+    uint32_t mask; /* matching days of the month, bits 1-31 */
+} cron_stream_month;
+
+size_t cron_stream_match(const cron_expr *expr, const time_t *dates, size_t n, uint8_t *matches, time_t *nexts) {
+    cron_stream_month month;
+    uint8_t lw_flags;
+    size_t count = 0;
+    size_t i;
+    time_t anchor = 0;
+    time_t next = CRON_INVALID_INSTANT;
+    int anchor_match = 0;
+    int cached = 0;
+    int res = 0;
+    if (!expr || !dates) return 0;
+    lw_flags = get_lw_flags(expr);
+    month.first = month.end = 0;
+    month.mask = 0;
+    for (i = 0; i < n; i++) {
+        time_t date = dates[i];
+        int match;
+        // Dates between the last decomposed one and its next fire time share its answer
+        if (!cached || date < anchor || (CRON_INVALID_INSTANT != next && date >= next)) {
+            int64_t days = (int64_t) date / CRON_SECONDS_PER_DAY;
+            int64_t sod = (int64_t) date % CRON_SECONDS_PER_DAY;
+            int64_t found = CRON_INVALID_INSTANT;
+            uint32_t later;
+            unsigned int mday;
+            int fire = -1;
+            if (sod < 0) {
+                sod += CRON_SECONDS_PER_DAY;
+                days--;
+            }
+            // Sorted dates stay in the month of the previous one most of the time: only the day offset changes
+            if (days < month.first || days >= month.end) {
+                int64_t year;
+                unsigned int mon, day;
+                civil_from_days(days, &year, &mon, &day);
+                month.first = days - day + 1;
+                month.end = month.first + days_in_month(year, mon);
+                month.mask = civil_month_days(expr, lw_flags, year, mon - 1, &res);
+                if (res) {
+                    month.end = month.first;
+                    month.mask = 0;
+                    res = 0;
+                }
+            }
+            mday = (unsigned int) (days - month.first + 1);
+            anchor = date;
+            anchor_match = (month.mask >> mday & 1) && cron_getBit(expr->hours, (unsigned int) sod / 3600) &&
+                           cron_getBit(expr->minutes, (unsigned int) sod / 60 % 60) &&
+                           cron_getBit(expr->seconds, (unsigned int) sod % 60);
+            // Next fire time within the day, then on the next matching day of the month, then searched
+            if (month.mask >> mday & 1 && sod + 1 < CRON_SECONDS_PER_DAY) {
+                fire = every_day_next(expr, (unsigned int) sod + 1);
             }
-            strncpy(tracking, subfields[i], res_lens[i]);
-            tracking += res_lens[i];
-            // Don't append comma to last list entry
-            if (i < subfields_len - 1) {
-                strncpy(tracking, ",",
-                        2); // using 2 to ensure the string ends in '\0', tracking will be set to that char
-                tracking += 1;
+            later = month.mask & ~(uint32_t) ((UINT64_C(2) << mday) - 1);
+            if (fire >= 0) {
+                found = days * CRON_SECONDS_PER_DAY + fire;
+            } else if (later) {
+                found = (month.first + count_trailing_zeros(later) - 1) * CRON_SECONDS_PER_DAY + every_day_next(expr, 0);
+            } else if (0 != civil_next(expr, (int64_t) date, &found)) {
+                found = CRON_INVALID_INSTANT;
             }
+            next = (int64_t) (time_t) found == found ? (time_t) found : CRON_INVALID_INSTANT;
+            cached = 1;
         }
-        free_splitted(subfields, subfields_len);
-        cronFree(field);
-        return accum_field;
+        match = date == anchor && anchor_match;
+        count += (size_t) match;
+        if (matches) matches[i] = (uint8_t) match;
+        if (nexts) nexts[i] = next;
     }
-    // only one H to find and replace, then return
-    field = replace_h_entry(field, pos, min, error);
-    return field;
-
-    return_error:
-    if (subfields) free_splitted(subfields, subfields_len);
-    if (accum_field) cronFree(accum_field);
-    return field;
+    return count;
 }
 
-static void set_months(char *value, uint8_t *targ, const char **error) {
-    int err;
-    unsigned int i;
+#endif /* CRON_USE_LOCAL_TIME */
 
-    char *replaced = NULL;
+/*
+ * Time zones
+ *
+ * A cron_zone holds the UTC offset transitions of a TZif file (RFC 8536) and the POSIX TZ rule of its footer,
+ * which applies after the last transition. Lookups are pure functions of the zone, so a loaded zone can be shared
+ * between threads without locking and without touching the libc time zone state.
+ */
 
-    err = to_upper(value);
-    if (err) return;
-    replaced = replace_ordinals(value, MONTHS_ARR, CRON_MONTHS_ARR_LEN);
-    if (!replaced) return;
-    replaced = check_and_replace_h(replaced, 4, 1, error);
-    if (*error) {
-        cronFree(replaced);
-        return;
-    }
+/** Day of a POSIX TZ rule: Jn (1-365, February 29th never counted), n (0-365) or Mm.w.d */
+typedef struct {
+    char type; /* 'J', 'N' or 'M' */
+    int day; /* Jn, n: day of year; Mm.w.d: day of week d */
+    int week; /* Mm.w.d: week w, 5 for the last one */
+    int month; /* Mm.w.d: month m, 1-12 */
+    int32_t time; /* local time of the transition in seconds after midnight, may be negative or exceed a day */
+} cron_tz_date;
+
+/** POSIX TZ rule, e.g. "CET-1CEST,M3.5.0,M10.5.0/3" */
+typedef struct {
+    int32_t std_offset; /* UTC offset of standard time in seconds, east positive */
+    int32_t dst_offset; /* UTC offset of daylight saving time */
+    int has_dst;
+    cron_tz_date start; /* start of daylight saving time, in local standard time */
+    cron_tz_date end; /* end of daylight saving time, in local daylight saving time */
+} cron_tz_rule;
+
+/* Range of UTC offsets allowed by RFC 8536, less than a day either way */
+#define CRON_MIN_UTC_OFFSET (-89999)
+#define CRON_MAX_UTC_OFFSET 93599
+
+struct cron_zone {
+    size_t count; /* number of transitions */
+    int64_t *times; /* transition instants, strictly ascending */
+    int32_t *offsets; /* UTC offset from each transition on */
+    int32_t initial; /* UTC offset before the first transition */
+    int has_rule; /* rule applies after the last transition */
+    cron_tz_rule rule;
+    cron_allocator allocator; /* allocator of the zone */
+};
+
+static uint32_t tzif_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
 
-    set_number_hits(replaced, targ, 1, CRON_MAX_MONTHS, error);
-    cronFree(replaced);
+static int64_t tzif_i64(const uint8_t *p) {
+    return (int64_t) ((uint64_t) tzif_u32(p) << 32 | tzif_u32(p + 4));
+}
 
-    /* ... and then rotate it to the front of the months */
-    for (i = 1; i < CRON_MAX_MONTHS; i++) {
-        if (cron_getBit(targ, i)) {
-            cron_setBit(targ, i - 1);
-            cron_delBit(targ, i);
+/** Parse [+-]hh[:mm[:ss]] of a POSIX TZ string into seconds, return the position after it or NULL on error */
+static const char *tz_parse_time(const char *str, const char *end, int32_t *seconds) {
+    int32_t sign = 1;
+    int32_t parts[3] = {0, 0, 0};
+    int i;
+    if (str < end && ('+' == *str || '-' == *str)) {
+        sign = '-' == *str ? -1 : 1;
+        str++;
+    }
+    for (i = 0; i < 3; i++) {
+        int digits = 0;
+        if (i > 0) {
+            if (str == end || ':' != *str) break;
+            str++;
         }
+        while (str < end && isdigit((unsigned char) *str) && digits < 3) {
+            parts[i] = parts[i] * 10 + (*str++ - '0');
+            digits++;
+        }
+        if (0 == digits || parts[i] > (0 == i ? 167 : 59)) return NULL;
     }
+    *seconds = sign * (parts[0] * 3600 + parts[1] * 60 + parts[2]);
+    return str;
 }
 
-static void set_days(char *field, uint8_t *targ, int max, const char **error) {
-    if (1 == strlen(field) && '?' == field[0]) {
-        field[0] = '*';
+/** Skip the zone abbreviation of a POSIX TZ string, alphabetic or quoted in <> */
+static const char *tz_parse_name(const char *str, const char *end) {
+    const char *start = str;
+    if (str < end && '<' == *str) {
+        while (str < end && '>' != *str) str++;
+        return str < end && str - start > 1 ? str + 1 : NULL;
     }
-    set_number_hits(field, targ, 0, max, error);
+    while (str < end && isalpha((unsigned char) *str)) str++;
+    return str - start >= 3 ? str : NULL;
 }
 
-static void set_days_of_month(char *field, uint8_t *targ, const char **error) {
-    /* Days of month start with 1 (in Cron and Calendar) so add one */
-    set_days(field, targ, CRON_MAX_DAYS_OF_MONTH, error);
-    /* ... and remove it from the front */
-    if (targ) {
-        cron_delBit(targ, 0);
+static const char *tz_parse_number(const char *str, const char *end, int min, int max, int *value) {
+    int digits = 0;
+    *value = 0;
+    while (str < end && isdigit((unsigned char) *str) && digits < 3) {
+        *value = *value * 10 + (*str++ - '0');
+        digits++;
     }
-
+    return digits && *value >= min && *value <= max ? str : NULL;
 }
 
-static char *replace_l_entry(char *field, unsigned int pos, cron_expr *target, const char **error) {
-    char *has_l = strchr(field, 'L');
-    if (!has_l) {
-        return field;
+/** Parse the date and optional /time of a POSIX TZ rule */
+static const char *tz_parse_date(const char *str, const char *end, cron_tz_date *date) {
+    date->time = 7200;
+    if (str < end && 'J' == *str) {
+        date->type = 'J';
+        str = tz_parse_number(str + 1, end, 1, 365, &date->day);
+    } else if (str < end && 'M' == *str) {
+        date->type = 'M';
+        str = tz_parse_number(str + 1, end, 1, 12, &date->month);
+        if (!str || str == end || '.' != *str) return NULL;
+        str = tz_parse_number(str + 1, end, 1, 5, &date->week);
+        if (!str || str == end || '.' != *str) return NULL;
+        str = tz_parse_number(str + 1, end, 0, 6, &date->day);
+    } else {
+        date->type = 'N';
+        str = tz_parse_number(str, end, 0, 365, &date->day);
     }
-    int err;
-    unsigned int offset;
-    char day_char[2];
-
-    switch (pos) {
-        case CRON_FIELD_DAY_OF_MONTH: {
-            // Possible usage: With offset, L-x days before last day of month
-            // Days of Week and Days of Month cannot be set to specific values in the same cron anymore.
-            // (Sub-)Field needs to start with L!
-            if (has_l != field) {
-                *error = "Element in Day of Month with 'L' doesn't begin with it";
-                return field;
-            }
-
-            // Ensure W day is not the last in a range or iterator of days
-            // Also, char following 'L' has to be either '-', 'W', ',' or '\0'; ',' shouldn't be possible as replace_l_entry is only fed split fields
-            if ( has_char(has_l, '/') || \
-                !((*(has_l + 1) == '-') || (*(has_l + 1) == 'W') || (*(has_l + 1) == ',') || (*(has_l + 1) == '\0'))) {
-                *error = "L only allowed in combination before an offset or before W in 'day of month' field";
-                return field;
-            }
-
-            cron_setBit(target->months, CRON_L_DOM_BIT);
-            if (*(has_l + 1) == '-') {
-                // offset is specified, L is starting dom
-                offset = parse_uint(has_l + 2, &err);
-                if (err) {
-                    *error = "Error parsing L offset in 'day of month'";
-                    return field;
-                }
-                if (offset == 0) {
-                    *error = "Invalid offset: Needs to be > 0";
-                    return field;
-                } else if (offset > 30) {
-                    // used to break, now it will simply set offset to 30
-                    offset = 30;
-                }
-                cron_setBit(target->l_dom_offset, offset);
-            } else {
-                // No offset, set first bit in l_dom_offset
-                cron_setBit(target->l_dom_offset, 0);
-            }
-            *has_l = '\0';
-            // Should result in a 0-length string, which is ok. The offset is stored separately
-            return field;
-        }
-        case CRON_FIELD_DAY_OF_WEEK: {
-            if ( has_char(field, '/') ) {
-                *error = "L can't be used with iterators in 'day of week' field";
-                // Commas shouldn't be present, as sub-fields are input here, '-' for ranges is ok
-                return field;
-            }
-            // 'L' with offset (or none)
-            if (has_l == field) {
-                if (strlen(field) == 1) {
-                    *has_l = '0'; // Only L, so replace with sunday
-                    return field;
-                }
-                if (*(has_l+1) == '-') {
-                    // Convert offset to proper day
-                    offset = parse_uint(has_l+2, &err);
-                    if (err) {
-                        *error = "Error parsing L offset in 'day of month'";
-                        return field;
-                    }
-                    if (offset == 0) {
-                        *error = "Invalid offset: Needs to be > 0";
-                        return field;
-                    } else if (offset > 6) {
-                        // used to break, now it will simply set offset to 6
-                        offset = 6;
-                    }
-                    // print offset instead of l; sprintf will append '\0' automatically
-                    sprintf(has_l, "%1u", 7-offset);
-                }
-            } else {
-                // Weekday L flag: Last x-day of month
-                // Check if char after needs to end (sub-)field
-                if (*(has_l+1) != '\0') {
-                    *error = "'L' in weekday doesn't end field";
-                    return field;
-                }
-                // check if char before 'L' is a decimal for a weekday
-                if (strnlen(field, CRON_MAX_STR_LEN_TO_SPLIT) > 2) {
-                    *error = "'L' in weekday is prefixed by non-weekday characters";
-                    return field;
-                }
-                if (!sscanf(field, "%[01234567]L", &day_char[0])) {
-                    *error = "'L' in weekday is preceded by non-weekday characters";
-                    return field;
-                }
-                cron_setBit(target->months, CRON_L_DOW_BIT);
-                day_char[1] = '\0';
-                offset = parse_uint(day_char, &err);
-                if (err) {
-                    *error = "Error parsing 'L' Weekday in DOW";
-                    return field;
-                }
-                if (offset == 7) {
-                    // SUN is 0 bit, but can be '7' in field
-                    offset = 0;
-                }
-                cron_setBit(target->l_dow_flags, offset);
-                memset(field, 0, sizeof(char)*(has_l-field+1)); // Day is marked in l_dow_flags, so an empty string can be returned
-            }
-            return field;
-        }
-        default:
-            *error = "Trying to find 'L' in unsupported field";
-            return field;
+    if (str && str < end && '/' == *str) {
+        str = tz_parse_time(str + 1, end, &date->time);
     }
+    return str;
 }
 
-static char *l_check(char *field, unsigned int pos, cron_expr *target, const char **error) {
-    char *has_l = strchr(field, 'L');
+/** Parse a POSIX TZ string like "CET-1CEST,M3.5.0,M10.5.0/3", return 0 on success */
+static int tz_parse_rule(const char *str, const char *end, cron_tz_rule *rule) {
+    int32_t offset;
+    memset(rule, 0, sizeof(*rule));
+    str = tz_parse_name(str, end);
+    if (!str) return 1;
+    str = tz_parse_time(str, end, &offset);
+    if (!str || -offset < CRON_MIN_UTC_OFFSET || -offset > CRON_MAX_UTC_OFFSET) return 1;
+    rule->std_offset = -offset; /* POSIX offsets are west positive */
+    if (str == end) return 0;
+    str = tz_parse_name(str, end);
+    if (!str) return 1;
+    rule->has_dst = 1;
+    rule->dst_offset = rule->std_offset + 3600;
+    if (str < end && ',' != *str) {
+        str = tz_parse_time(str, end, &offset);
+        if (!str || -offset < CRON_MIN_UTC_OFFSET || -offset > CRON_MAX_UTC_OFFSET) return 1;
+        rule->dst_offset = -offset;
+    }
+    if (str == end) {
+        /* No rule given, use the US rules as most implementations do */
+        static const cron_tz_date US_START = {'M', 0, 2, 3, 7200};
+        static const cron_tz_date US_END = {'M', 0, 1, 11, 7200};
+        rule->start = US_START;
+        rule->end = US_END;
+        return 0;
+    }
+    if (',' != *str) return 1;
+    str = tz_parse_date(str + 1, end, &rule->start);
+    if (!str || str == end || ',' != *str) return 1;
+    str = tz_parse_date(str + 1, end, &rule->end);
+    return str == end ? 0 : 1;
+}
 
-    if (!has_l) {
-        return field;
+/** Seconds since 1970-01-01 of the local midnight starting the day of a POSIX TZ rule in year */
+static int64_t tz_date_local(const cron_tz_date *date, int64_t year) {
+    int64_t days;
+    if ('J' == date->type) {
+        days = days_from_civil(year, 1, 1) + date->day - 1;
+        if (date->day >= 60 && 29 == days_in_month(year, 2)) days++;
+    } else if ('N' == date->type) {
+        days = days_from_civil(year, 1, 1) + date->day;
+    } else {
+        int64_t first = days_from_civil(year, (unsigned int) date->month, 1);
+        unsigned int mday = (unsigned int) ((date->day - weekday_from_days(first) + 7) % 7) + 1 +
+                            (unsigned int) (date->week - 1) * 7;
+        while (mday > days_in_month(year, (unsigned int) date->month)) mday -= 7;
+        days = first + mday - 1;
     }
+    return days * CRON_SECONDS_PER_DAY + date->time;
+}
 
-    char *has_comma = strchr(field, ',');
-    char *new_field = field;
-    char **subfields = NULL;
-    size_t subfields_len = 0;
-    if (has_comma) {
-        // split list into subfields
-        subfields = split_str(field, ',', &subfields_len);
-        if (!subfields) {
-            *error = "Failed to split 'L' in list";
-            goto return_res;
-        }
-        size_t orig_len = strnlen(field, CRON_MAX_STR_LEN_TO_SPLIT);
-        // allocate new field, with same length as current field; should be supported, as at least one letter is dropped
-        new_field = (char *) cronMalloc(sizeof(char) * orig_len);
-        if (new_field == NULL) {
-            *error = "Failed to allocate string for 'L' replacement";
-            goto return_res;
-        }
-        memset(new_field, 0, orig_len);
-        char *tracking = new_field;
-        // replace_l_entry for each, return field with replacements
-        for (size_t i = 0; i < subfields_len; i++) {
-            if ((tracking - new_field) > orig_len) {
-                *error = "Failed to merge strings during 'L' replacement: String went oob";
-                goto return_res;
-            }
-            subfields[i] = replace_l_entry(subfields[i], pos, target, error);
-            if (*error != NULL) {
-                goto return_res;
-            }
-            if (strnlen(subfields[i], CRON_MAX_STR_LEN_TO_SPLIT) > 0) {
-                // No comma for first field separation, or an empty field
-                if (i > 0) {
-                    strncpy(tracking, ",", 1);
-                    tracking += 1;
-                }
-                strncpy(tracking, subfields[i], strnlen(subfields[i], CRON_MAX_STR_LEN_TO_SPLIT));
-                tracking += strnlen(subfields[i], CRON_MAX_STR_LEN_TO_SPLIT);
+/** UTC offset of a POSIX TZ rule at instant t, the last instant at or before t and the next instant after t at
+ * which it changes */
+static void tz_rule_lookup(const cron_tz_rule *rule, int64_t t, int32_t *offset, int64_t *prev, int64_t *next) {
+    int64_t times[6];
+    int32_t offsets[6];
+    int64_t y, year;
+    unsigned int m, d;
+    int i, j, n = 0;
+    *offset = rule->std_offset;
+    *prev = INT64_MIN;
+    *next = INT64_MAX;
+    if (!rule->has_dst) return;
+    civil_from_days((t + rule->std_offset) / CRON_SECONDS_PER_DAY, &year, &m, &d);
+    // The transitions of the years around t, ordered by instant; equal instants keep the year order
+    for (y = year - 1; y <= year + 1; y++) {
+        int64_t start = tz_date_local(&rule->start, y) - rule->std_offset;
+        int64_t end = tz_date_local(&rule->end, y) - rule->dst_offset;
+        for (i = 0; i < 2; i++) {
+            int64_t time = 0 == i ? start : end;
+            for (j = n; j > 0 && times[j - 1] > time; j--) {
+                times[j] = times[j - 1];
+                offsets[j] = offsets[j - 1];
             }
+            times[j] = time;
+            offsets[j] = 0 == i ? rule->dst_offset : rule->std_offset;
+            n++;
         }
-        goto return_res;
     }
-    // Replace the L in the current field
-    new_field = replace_l_entry(field, pos, target, error);
-    return_res:
-    if (subfields) free_splitted(subfields, subfields_len);
-    if (new_field != field) cronFree(field); // field was replaced successfully
-    return new_field;
+    for (i = 0; i < n; i++) {
+        if (times[i] > t) {
+            *next = times[i];
+            break;
+        }
+        *offset = offsets[i];
+        *prev = times[i];
+    }
 }
 
-static char *w_check(char *field, cron_expr *target, const char **error) {
-    char *has_w = strchr(field, 'W');
+cron_zone *cron_zone_parse(const uint8_t *data, size_t len, const char **error) {
+    return cron_zone_parse_ex(data, len, NULL, error);
+}
 
-    if (!has_w) {
-        return field;
+cron_zone *cron_zone_parse_ex(const uint8_t *data, size_t len, const cron_allocator *allocator, const char **error) {
+    const char *err_local;
+    const uint8_t *p = data;
+    const uint8_t *end = data + len;
+    uint32_t timecnt, typecnt, charcnt, leapcnt, isstdcnt, isutcnt;
+    size_t time_size = 4;
+    size_t i;
+    const uint8_t *times, *indices, *types;
+    cron_zone *zone = NULL;
+    if (!error) {
+        error = &err_local;
     }
-
-    char *newField = NULL;
-    char **splitField = NULL;
-    size_t len_out = 0;
-
-    unsigned int w_day = 0;
-    int err;
-
-    // Only available for dom, so no pos checking needed
-    newField = (char *) cronMalloc(sizeof(char) * strlen(field));
-    if (!newField) {
-        *error = "w_check: newField malloc error";
+    *error = NULL;
+    if (!data || len < 44 || 0 != memcmp(data, "TZif", 4)) {
+        *error = "Invalid TZif data";
         goto return_error;
     }
-    memset(newField, 0, sizeof(char) * strlen(field));
-    char *tracking = newField;
-    // Ensure no specific days are set in day of week
-    // Already checked in cron_parse_expr
-    splitField = split_str(field, ',', &len_out);
-    if (!splitField) {
-        *error = "Error splitting 'day of month' field for W detection";
+    for (;;) {
+        isutcnt = tzif_u32(p + 20);
+        isstdcnt = tzif_u32(p + 24);
+        leapcnt = tzif_u32(p + 28);
+        timecnt = tzif_u32(p + 32);
+        typecnt = tzif_u32(p + 36);
+        charcnt = tzif_u32(p + 40);
+        if (0 == typecnt || typecnt > 256 || timecnt > (size_t) (end - p) || charcnt > (size_t) (end - p) ||
+            leapcnt > (size_t) (end - p) || isstdcnt > (size_t) (end - p) || isutcnt > (size_t) (end - p) ||
+            (size_t) (end - p - 44) < timecnt * (time_size + 1) + typecnt * 6 + charcnt +
+                                      leapcnt * (time_size + 4) + isstdcnt + isutcnt) {
+            *error = "Invalid TZif data";
+            goto return_error;
+        }
+        if (8 == time_size || '2' > data[4]) break;
+        /* Version 2 and later: skip the 32 bit data, use the 64 bit data following it */
+        p += 44 + timecnt * 5 + typecnt * 6 + charcnt + leapcnt * 8 + isstdcnt + isutcnt;
+        time_size = 8;
+        if ((size_t) (end - p) < 44 || 0 != memcmp(p, "TZif", 4)) {
+            *error = "Invalid TZif data";
+            goto return_error;
+        }
+    }
+    times = p + 44;
+    indices = times + timecnt * time_size;
+    types = indices + timecnt;
+
+    allocator = call_allocator(allocator);
+    zone = (cron_zone *) cron_alloc(allocator, sizeof(cron_zone) + timecnt * (sizeof(int64_t) + sizeof(int32_t)));
+    if (!zone) {
+        *error = "Out of memory";
         goto return_error;
     }
-    for (size_t i = 0; i < len_out; i++) {
-        if ((has_w = strchr(splitField[i], 'W'))) {
-            // Ensure W day is not the end or beginning of a range or iterator
-            if (has_char(splitField[i], '/') || has_char(splitField[i], '-')) {
-                *error = "W not allowed in iterators or ranges in 'day of month' field";
-                goto return_error;
-            }
-            // Ensure nothing follows 'W'
-            if (*(has_w + 1) != '\0') {
-                *error = "If W is used, 'day of month' element needs to end with it";
+    memset(zone, 0, sizeof(cron_zone));
+    zone->allocator = *allocator;
+    zone->count = timecnt;
+    zone->times = (int64_t *) (zone + 1);
+    zone->offsets = (int32_t *) (zone->times + timecnt);
+    zone->initial = (int32_t) tzif_u32(types);
+    for (i = 0; i < timecnt; i++) {
+        zone->times[i] = 8 == time_size ? tzif_i64(times + i * 8) : (int64_t) (int32_t) tzif_u32(times + i * 4);
+        if ((i > 0 && zone->times[i] <= zone->times[i - 1]) || indices[i] >= typecnt) {
+            *error = "Invalid TZif data";
+            goto return_error;
+        }
+        zone->offsets[i] = (int32_t) tzif_u32(types + indices[i] * 6);
+    }
+    for (i = 0; i < typecnt; i++) {
+        int32_t offset = (int32_t) tzif_u32(types + i * 6);
+        if (offset < CRON_MIN_UTC_OFFSET || offset > CRON_MAX_UTC_OFFSET) {
+            *error = "Invalid TZif data";
+            goto return_error;
+        }
+    }
+
+    /* Footer of version 2 and later: POSIX TZ string for the instants after the last transition */
+    p = types + typecnt * 6 + charcnt + leapcnt * (time_size + 4) + isstdcnt + isutcnt;
+    if (8 == time_size && p < end && '\n' == *p) {
+        const uint8_t *footer = ++p;
+        while (p < end && '\n' != *p) p++;
+        if (p == end) {
+            *error = "Invalid TZif footer";
+            goto return_error;
+        }
+        if (p > footer) {
+            if (0 != tz_parse_rule((const char *) footer, (const char *) p, &zone->rule)) {
+                *error = "Invalid TZif footer";
                 goto return_error;
             }
-            if (!(strcmp(splitField[i], "LW"))) {
-                cron_setBit(target->w_flags, 0);
-            } else {
-                *has_w = '\0';
-                w_day = parse_uint(splitField[i], &err);
-                if (err) {
-                    *error = "Error reading uint in w-check";
-                    goto return_error;
-                }
-                cron_setBit(target->w_flags, w_day);
-            }
-        } else {
-            if (tracking != newField) {
-                // A field was already added. Add a comma first
-                strncpy(tracking, ",", 2); // ensure string ends in '\0', tracking will be set to it
-                tracking += 1;
-            }
-            size_t field_len = strnlen(splitField[i], CRON_MAX_STR_LEN_TO_SPLIT);
-            strncpy(tracking, splitField[i], field_len);
-            tracking += field_len;
+            zone->has_rule = 1;
         }
     }
-    free_splitted(splitField, len_out);
-    cronFree(field);
-    cron_setBit(target->months, CRON_W_DOM_BIT);
-    return newField;
+    return zone;
 
     return_error:
-    if (splitField) free_splitted(splitField, len_out);
-    if (newField) cronFree(newField);
-    return field;
+    cron_zone_free(zone);
+    return NULL;
 }
 
-void cron_parse_expr(const char *expression, cron_expr *target, const char **error) {
+cron_zone *cron_zone_load(const char *path, const char **error) {
+    return cron_zone_load_ex(path, NULL, error);
+}
+
+cron_zone *cron_zone_load_ex(const char *path, const cron_allocator *allocator, const char **error) {
     const char *err_local;
+    FILE *file = NULL;
+    uint8_t *data = NULL;
     size_t len = 0;
-    char **fields = NULL;
-    char *days_replaced = NULL;
-    int notfound = 0;
+    size_t cap = 4096;
+    cron_zone *zone = NULL;
     if (!error) {
         error = &err_local;
     }
     *error = NULL;
-    if (!expression) {
-        *error = "Invalid NULL expression";
+    allocator = call_allocator(allocator);
+    if (!path || !(file = fopen(path, "rb"))) {
+        *error = "Cannot open TZif file";
         goto return_res;
     }
-
-    if (!target) {
-        *error = "Invalid target";
-        goto return_res;
+    for (;;) {
+        uint8_t *grown = (uint8_t *) cron_alloc(allocator, cap);
+        if (!grown) {
+            *error = "Out of memory";
+            goto return_res;
+        }
+        if (data) {
+            memcpy(grown, data, len);
+            cron_free(allocator, data);
+        }
+        data = grown;
+        len += fread(data + len, 1, cap - len, file);
+        if (len < cap) break;
+        cap *= 2;
     }
-    memset(target, 0, sizeof(*target));
-
-    fields = split_str(expression, ' ', &len);
-    if (len != 6) {
-        *error = "Invalid number of fields, expression must consist of 6 fields";
+    if (ferror(file)) {
+        *error = "Cannot read TZif file";
         goto return_res;
     }
+    zone = cron_zone_parse_ex(data, len, allocator, error);
 
-    fields[0] = check_and_replace_h(fields[0], 0, 0, error);
-    if (*error) goto return_res;
-    set_number_hits(fields[0], target->seconds, 0, CRON_MAX_SECONDS, error);
-    if (*error) goto return_res;
-
-    fields[1] = check_and_replace_h(fields[1], 1, 0, error);
-    if (*error) goto return_res;
-    set_number_hits(fields[1], target->minutes, 0, CRON_MAX_MINUTES, error);
-    if (*error) goto return_res;
-
-    fields[2] = check_and_replace_h(fields[2], 2, 0, error);
-    if (*error) goto return_res;
-    set_number_hits(fields[2], target->hours, 0, CRON_MAX_HOURS, error);
-    if (*error) goto return_res;
-
-    // Don't allow specific values for DOM and DOW at the same time
-    if ( ((strcmp(fields[3], "*") != 0) && (strcmp(fields[3], "?") != 0)) &&
-            ((strcmp(fields[5], "*") != 0) && (strcmp(fields[5], "?") != 0)) ) {
-        *error = "Cannot set specific values for day of month AND day of week";
-        goto return_res;
-    }
+    return_res:
+    cron_free(allocator, data);
+    if (file) fclose(file);
+    return zone;
+}
 
-    to_upper(fields[5]);
-    days_replaced = replace_ordinals(fields[5], DAYS_ARR, CRON_DAYS_ARR_LEN);
-    days_replaced = check_and_replace_h(days_replaced, 5, 1, error);
-    if (*error) {
-        cronFree(days_replaced);
-        goto return_res;
-    }
-    days_replaced = l_check(days_replaced, 5, target, error);
-    if (*error) {
-        cronFree(days_replaced);
-        goto return_res;
-    }
-    if (strnlen(days_replaced, CRON_MAX_STR_LEN_TO_SPLIT) == 0) {
-        days_replaced[0] = '*'; // Ensure all weekdays are available if the field is empty (L flags)
-    }
-    set_days(days_replaced, target->days_of_week, CRON_MAX_DAYS_OF_WEEK, error);
-    cronFree(days_replaced);
-    if (*error) goto return_res;
-    if (cron_getBit(target->days_of_week, 7)) {
-        /* Sunday can be represented as 0 or 7*/
-        cron_setBit(target->days_of_week, 0);
-        cron_delBit(target->days_of_week, 7);
-    }
+void cron_zone_free(cron_zone *zone) {
+    if (zone) cron_free(&zone->allocator, zone);
+}
 
-    // Days of month: Ensure L-flag for dow is unset, unless the field is '*'
-    if ((strcmp(fields[3], "*") != 0) && (strcmp(fields[3], "?") != 0)) {
-        if (cron_getBit(target->months, CRON_L_DOW_BIT)) {
-            *error = "Cannot specify specific days of month when using 'L' in days of week.";
-            goto return_res;
+/** UTC offset of zone at instant t, the last transition at or before t (INT64_MIN if none) and the next one
+ * after t (INT64_MAX if none) */
+static void zone_lookup(const cron_zone *zone, int64_t t, int32_t *offset, int64_t *prev, int64_t *next) {
+    size_t lo = 0;
+    size_t hi = zone->count;
+    // Binary search the number of transitions at or before t
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (zone->times[mid] <= t) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    fields[3] = check_and_replace_h(fields[3], 3, 1, error);
-    if (*error) goto return_res;
-    // Days of month: Test for W, if there, set appropriate w_flags in target
-    fields[3] = w_check(fields[3], target, error);
-    if (*error) goto return_res;
-    // Days of month: Test for L, if there, set 15th bit in months
-    fields[3] = l_check(fields[3], 3, target, error);
-    if (*error) goto return_res;
-    // If w flags are set, days of month can be empty (e.g. "LW" or "9W" or "L")
-    // So parsing has to happen if the field str len > 0, but can be skipped if a W flag or L (DOM) flag was found
-    // Check W flags
-    next_set_bit(target->w_flags, CRON_MAX_DAYS_OF_MONTH, 0, &notfound);
-    if (notfound) {
-        notfound = 0;
-        // Check L (DOM) flags as well; if they don't exist as well, DOM needs to be checked
-        next_set_bit(target->l_dom_offset, CRON_MAX_DAYS_OF_MONTH, 0, &notfound);
+    *offset = 0 == lo ? zone->initial : zone->offsets[lo - 1];
+    *prev = 0 == lo ? INT64_MIN : zone->times[lo - 1];
+    *next = lo < zone->count ? zone->times[lo] : INT64_MAX;
+    if (lo == zone->count && zone->has_rule) {
+        int64_t rule_prev;
+        tz_rule_lookup(&zone->rule, t, offset, &rule_prev, next);
+        if (rule_prev > *prev) *prev = rule_prev;
     }
-    if (strlen(fields[3]) || notfound) set_days_of_month(fields[3], target->days_of_month, error);
-    if (*error) goto return_res;
-
-    set_months(fields[4], target->months, error); // check_and_replace_h incorporated into set_months
-    if (*error) goto return_res;
-
-    goto return_res;
-
-    return_res:
-    free_splitted(fields, len);
 }
 
-time_t cron_next(const cron_expr *expr, time_t date) {
-    /*
-     The plan:
-
-     1 Round up to the next whole second
+static int32_t zone_offset_at(const cron_zone *zone, int64_t t) {
+    int32_t offset;
+    int64_t prev, next;
+    zone_lookup(zone, t, &offset, &prev, &next);
+    return offset;
+}
 
-     2 If seconds match move on, otherwise find the next match:
-     2.1 If next match is in the next minute then roll forwards
+int32_t cron_zone_offset(const cron_zone *zone, time_t date) {
+    return zone ? zone_offset_at(zone, (int64_t) date) : 0;
+}
 
-     3 If minute matches move on, otherwise find the next match
-     3.1 If next match is in the next hour then roll forwards
-     3.2 Reset the seconds and go to 2
+time_t cron_next_tz(const cron_expr *expr, const cron_zone *zone, time_t date) {
+    int64_t start; // first instant to consider
+    int64_t covered = INT64_MIN; // last wall-clock time passed before a backward transition
+    int64_t res;
+    int32_t offset, prev_offset;
+    int64_t prev, transition, unused;
+    if (!expr || !zone || !civil_in_range((int64_t) date)) return CRON_INVALID_INSTANT;
+    start = (int64_t) date + 1;
+    // The span of date itself, not of start: a transition at start is the end of the first span, so the wall-clock
+    // times it skips still fire at it
+    zone_lookup(zone, (int64_t) date, &offset, &prev, &transition);
+    if (INT64_MIN != prev) {
+        zone_lookup(zone, prev - 1, &prev_offset, &unused, &unused);
+        if (prev_offset > offset) covered = prev - 1 + prev_offset;
+    }
+    // Search the wall-clock time of each span of constant UTC offset, moving on at each transition
+    for (;;) {
+        int32_t next_offset;
+        int64_t local = start + offset;
+        if (local <= covered) local = covered + 1;
+        if (0 != civil_next(expr, local - 1, &res)) return CRON_INVALID_INSTANT;
+        if (res - offset < transition) {
+            res -= offset;
+            break;
+        }
+        zone_lookup(zone, transition, &next_offset, &unused, &unused);
+        if (next_offset > offset && res < transition + next_offset) {
+            /* Wall-clock time skipped by a forward transition: fire at the transition */
+            res = transition;
+            break;
+        }
+        /* After a backward transition, the repeated wall-clock times fire only at their first occurrence */
+        if (transition - 1 + offset > covered) covered = transition - 1 + offset;
+        start = transition;
+        zone_lookup(zone, start, &offset, &unused, &transition);
+    }
+    if ((int64_t) (time_t) res != res) return CRON_INVALID_INSTANT;
+    return (time_t) res;
+}
 
-     4 If hour matches move on, otherwise find the next match
-     4.1 If next match is in the next day then roll forwards,
-     4.2 Reset the minutes and seconds and go to 2
+#ifdef CRON_USE_LOCAL_TIME
+
+/** First instant whose wall-clock time in zone is at or after local: the first occurrence of a repeated
+ * wall-clock time, the transition for a skipped one */
+static int64_t zone_local_to_utc(const cron_zone *zone, int64_t local) {
+    int32_t offset;
+    int64_t prev, next;
+    int64_t start = local - 2 * CRON_SECONDS_PER_DAY; // before any wall-clock time at or after local
+    zone_lookup(zone, start, &offset, &prev, &next);
+    for (;;) {
+        if (local - offset < start) return start;
+        if (local - offset < next) return local - offset;
+        start = next;
+        zone_lookup(zone, start, &offset, &prev, &next);
+    }
+}
 
-     ...
-     */
-    if (!expr) return CRON_INVALID_INSTANT;
-    struct tm calval;
-    memset(&calval, 0, sizeof(struct tm));
-    struct tm *calendar = cron_time(&date, &calval);
-    if (!calendar) return CRON_INVALID_INSTANT;
-    time_t original = cron_mktime(calendar);
-    if (CRON_INVALID_INSTANT == original) return CRON_INVALID_INSTANT;
+/** Match of instant t by expr decided by the last transition of zone, as cron_next_tz() fires around it: 1 at a
+ * forward transition skipping a wall-clock time of expr, 0 at the second occurrence of a wall-clock time repeated
+ * by a backward transition, -1 if the wall-clock time of t decides */
+static int zone_transition_match(const cron_expr *expr, const cron_zone *zone, int64_t t) {
+    int32_t offset, prev_offset;
+    int64_t prev, next, unused;
+    int64_t res;
+    zone_lookup(zone, t, &offset, &prev, &next);
+    if (INT64_MIN == prev) return -1;
+    zone_lookup(zone, prev - 1, &prev_offset, &unused, &unused);
+    if (prev_offset > offset) {
+        // Wall-clock times up to prev - 1 + prev_offset passed before the transition already
+        return t + offset <= prev - 1 + prev_offset ? 0 : -1;
+    }
+    if (prev != t || prev_offset == offset) return -1;
+    // Skipped wall-clock times: [t + prev_offset, t + offset[
+    return 0 == civil_next(expr, t - 1 + prev_offset, &res) && res < t + offset ? 1 : -1;
+}
 
-    int res = do_next(expr, calendar, calendar->tm_year);
-    if (0 != res) return CRON_INVALID_INSTANT;
+/** Zone of a POSIX TZ string like "CET-1CEST,M3.5.0,M10.5.0/3", NULL if it is invalid */
+static cron_zone *zone_from_rule(const char *tz) {
+    cron_zone *zone = (cron_zone *) cron_alloc(&cron_current_allocator, sizeof(cron_zone));
+    if (!zone) return NULL;
+    memset(zone, 0, sizeof(cron_zone));
+    zone->allocator = cron_current_allocator;
+    if (0 != tz_parse_rule(tz, tz + strlen(tz), &zone->rule)) {
+        cron_zone_free(zone);
+        return NULL;
+    }
+    zone->has_rule = 1;
+    zone->initial = zone->rule.std_offset;
+    return zone;
+}
 
-    time_t calculated = cron_mktime(calendar);
-    if (CRON_INVALID_INSTANT == calculated) return CRON_INVALID_INSTANT;
-    if (calculated == original) {
-        /* We arrived at the original timestamp - round up to the next whole second and try again... */
-        res = add_to_field(calendar, CRON_CF_SECOND, 1);
-        if (0 != res) return CRON_INVALID_INSTANT;
-        res = do_next(expr, calendar, calendar->tm_year);
-        if (0 != res) return CRON_INVALID_INSTANT;
+int cron_local_zone_refresh(void) {
+    const char *tz = getenv("TZ");
+    const char *dir = getenv("TZDIR");
+    cron_zone *zone = NULL;
+    cron_zone *old = local_zone;
+    if (!tz) {
+        zone = cron_zone_load("/etc/localtime", NULL);
+    } else {
+        if (':' == *tz) tz++;
+        if (!*tz) {
+            zone = zone_from_rule("UTC0");
+        } else if ('/' == *tz) {
+            zone = cron_zone_load(tz, NULL);
+        } else if (!strstr(tz, "..")) {
+            char path[512];
+            if (!dir) dir = "/usr/share/zoneinfo";
+            int len = snprintf(path, sizeof(path), "%s/%s", dir, tz);
+            if (len >= 0 && (size_t) len < sizeof(path)) {
+                zone = cron_zone_load(path, NULL);
+            }
+        }
+        if (!zone) zone = zone_from_rule(tz);
     }
+    if (!zone) return -1;
+    local_zone = zone;
+    cron_zone_free(old);
+    return 0;
+}
 
-    return cron_mktime(calendar);
+void cron_local_zone_clear(void) {
+    cron_zone *old = local_zone;
+    local_zone = NULL;
+    cron_zone_free(old);
 }
+
+#endif /* CRON_USE_LOCAL_TIME */
@@ -60,6 +60,9 @@ typedef struct {
     uint8_t w_flags[4]; // Bits 0-30 for days 1-31, bit 31 for 'L'
     uint8_t l_dom_offset[4]; // Offset days for L in day of month, bits 0-30 are used
     uint8_t months[2];
+    uint8_t kind; // Evaluator for cron_next selected by cron_parse_expr or cron_classify, 0 for the general search
+    uint32_t period; // Fixed period expressions: seconds between two fire times, a divisor of a day
+    uint32_t offset; // Fixed period expressions: second of day of the first fire time
 } cron_expr;
 
 /**
@@ -76,6 +79,44 @@ typedef struct {
  */
 void cron_parse_expr(const char *expression, cron_expr *target, const char **error);
 
+/**
+ * Cache of parsed expressions, for many jobs sharing a few expressions.
+ * Can be shared between threads.
+ */
+typedef struct cron_parse_cache cron_parse_cache;
+
+/**
+ * Creates an empty parse cache, allocated by the allocator set by 'cron_set_allocator'.
+ *
+ * @param capacity maximum number of cached expressions, taking 650 bytes to 1.3 KB each
+ * @return created cache, to be freed using 'cron_parse_cache_free'. NULL is returned on error.
+ */
+cron_parse_cache *cron_parse_cache_create(size_t capacity);
+
+/**
+ * Frees a cache created by 'cron_parse_cache_create'.
+ *
+ * @param cache cache to free, may be NULL
+ */
+void cron_parse_cache_free(cron_parse_cache *cache);
+
+/**
+ * @param cache cache created by 'cron_parse_cache_create'
+ * @return number of cached expressions
+ */
+size_t cron_parse_cache_count(cron_parse_cache *cache);
+
+/**
+ * Same as 'cron_parse_expr', copying the result of an earlier call with
+ * the same expression from the cache. Expressions are compared with their
+ * white space normalized; those with 'H' are only reused with the same
+ * seed and hash function. Valid expressions are added until the cache is
+ * full, invalid ones are parsed each time.
+ *
+ * @param cache cache created by 'cron_parse_cache_create', NULL to parse without cache
+ */
+void cron_parse_expr_cached(cron_parse_cache *cache, const char *expression, cron_expr *target, const char **error);
+
 /**
  * Uses the specified expression to calculate the next 'fire' date after
  * the specified date. All dates are processed as UTC (GMT) dates 
@@ -89,7 +130,546 @@ void cron_parse_expr(const char *expression, cron_expr *target, const char **err
 time_t cron_next(const cron_expr *expr, time_t date);
 
 /**
- * uint8_t* replace char* for storing hit dates, set_bit and get_bit are used as handlers
+ * Same as 'cron_next' on broken-down calendar dates, without converting
+ * them from and to time_t. Only the date and time of day fields of 'in'
+ * are read, normalized like 'timegm' does; they are searched as they are,
+ * without time zone or daylight saving time, so chained calls can stay in
+ * calendar time. 'out' gets all date and time fields including 'tm_wday'
+ * and 'tm_yday', with 'tm_isdst' set to -1.
+ *
+ * @param expr parsed cron expression to use in next date calculation
+ * @param in start date to start calculation from
+ * @param out receives the next 'fire' date, may be the same as 'in'
+ * @return 0 in case of success, -1 in case of error.
+ */
+int cron_next_tm(const cron_expr *expr, const struct tm *in, struct tm *out);
+
+/**
+ * Uses the specified expression to calculate the last 'fire' date at or before
+ * the specified date. Dates are processed the same way as in 'cron_next'.
+ *
+ * @param expr parsed cron expression to use in previous date calculation
+ * @param date start date to search backwards from; returned itself if it matches the expression
+ * @return previous 'fire' date in case of success, '((time_t) -1)' in case of error.
+ */
+time_t cron_prev(const cron_expr *expr, time_t date);
+
+/**
+ * Checks whether the expression has any 'fire' date. Whether its days of
+ * month, months, days of week and L/W flags can be satisfied at all, like
+ * "0 0 0 30 2 ?" can't, is decided once by 'cron_parse_expr': no date matches
+ * in a full 400-year cycle of the calendar. 'cron_next' and 'cron_prev' fail
+ * right away on such expressions.
+ *
+ * @param expr parsed cron expression to check
+ * @return 1 if the expression fires at some date, 0 if it never does or in case of error.
+ */
+int cron_satisfiable(const cron_expr *expr);
+
+/**
+ * Selects the evaluator of 'cron_next' for an expression again after its
+ * bits were changed, e.g. with 'cron_setBit'/'cron_delBit'. The evaluator
+ * is chosen by 'cron_parse_expr' for the parsed bits: a parsed expression
+ * changed without calling this keeps the fast path of its old bits, and
+ * e.g. never fires if those couldn't be satisfied. Expressions zeroed and
+ * filled by hand use the general search and don't need it.
+ *
+ * @param expr expression whose bits were changed
+ */
+void cron_classify(cron_expr *expr);
+
+/**
+ * Checks whether the specified date is a 'fire' date of the expression,
+ * the same as 'cron_next(expr, date - 1) == date' but without searching:
+ * the date is split into its fields once and each field is looked up
+ * in the parsed expression.
+ *
+ * @param expr parsed cron expression to check against
+ * @param date date to check
+ * @return 1 if 'date' is a 'fire' date, 0 otherwise or in case of error.
+ */
+int cron_matches(const cron_expr *expr, time_t date);
+
+/**
+ * Writes all 'fire' dates after 'from' up to and including 'to' into 'out',
+ * in ascending order, as long as 'cap' allows. Same results as calling
+ * 'cron_next' repeatedly, but days are only matched once and the fire
+ * times within a day are enumerated directly from the parsed fields.
+ * To continue a filled buffer, call again with the last written date as 'from'.
+ *
+ * @param expr parsed cron expression to use in the calculation
+ * @param from start date, not included in the result
+ * @param to end date, included in the result
+ * @param out buffer receiving the 'fire' dates
+ * @param cap number of dates 'out' can hold
+ * @return number of dates written to 'out'
+ */
+size_t cron_fill_range(const cron_expr *expr, time_t from, time_t to, time_t *out, size_t cap);
+
+/**
+ * Counts the 'fire' dates after 'from' up to and including 'to', without
+ * enumerating them: the matching days of each month are multiplied by the
+ * fire times per day. Runs in time proportional to the number of months
+ * in the interval.
+ *
+ * @param expr parsed cron expression to use in the calculation
+ * @param from start date, not included in the count
+ * @param to end date, included in the count
+ * @return number of 'fire' dates, -1 in case of error.
+ */
+int64_t cron_count(const cron_expr *expr, time_t from, time_t to);
+
+/**
+ * Calculates the k-th 'fire' date after the specified date, skipping whole
+ * months and days by their number of fire times. cron_nth(expr, date, 1)
+ * is the same as cron_next(expr, date).
+ *
+ * @param expr parsed cron expression to use in the calculation
+ * @param from start date to start calculation from
+ * @param k index of the 'fire' date after 'from', starting at 1
+ * @return k-th 'fire' date in case of success, '((time_t) -1)' in case of error.
+ */
+time_t cron_nth(const cron_expr *expr, time_t from, uint64_t k);
+
+/**
+ * Annotates a sorted array of dates, the same as 'matches[i] = cron_matches(expr, dates[i])'
+ * and 'nexts[i] = cron_next(expr, dates[i])'. Dates before the next 'fire' date of a
+ * previous one reuse its answer; the others are split into their fields relative to the
+ * month of the previous one, resolving the days of a month once.
+ *
+ * @param expr parsed cron expression to use in the calculation
+ * @param dates dates sorted in ascending order; unsorted dates give the same results, only slower
+ * @param n number of dates
+ * @param matches receives 1 for each 'fire' date, 0 for the others; must hold 'n' values, may be NULL
+ * @param nexts receives the next 'fire' date after each date, '((time_t) -1)' if there is none;
+ *        must hold 'n' dates, may be NULL
+ * @return number of 'fire' dates in 'dates'
+ */
+size_t cron_stream_match(const cron_expr *expr, const time_t *dates, size_t n, uint8_t *matches, time_t *nexts);
+
+/**
+ * Cron expression remembering its last 'cron_next' query, for callers polling
+ * with a steadily increasing date. Initialize it with 'cron_cursor_init'.
+ */
+typedef struct {
+    cron_expr expr;
+    time_t from; // date of the last computed query
+    time_t next; // 'fire' date after 'from'
+    int cached; // 1 once 'from' and 'next' are set
+} cron_cursor;
+
+/**
+ * Initializes a cursor with an expression and an empty cache.
+ *
+ * @param cursor cursor to initialize
+ * @param expr parsed cron expression, copied into the cursor
+ */
+void cron_cursor_init(cron_cursor *cursor, const cron_expr *expr);
+
+/**
+ * Same as 'cron_next(&cursor->expr, date)'. The answer of the last computed
+ * query is returned again without searching while 'date' stays in
+ * ['from', 'next'[; a later date, or an earlier one after the clock was set
+ * back, computes and caches a new answer.
+ *
+ * @param cursor cursor initialized by 'cron_cursor_init'
+ * @param date start date to start calculation from
+ * @return next 'fire' date in case of success, '((time_t) -1)' in case of error.
+ */
+time_t cron_cursor_next(cron_cursor *cursor, time_t date);
+
+/**
+ * State of an expression checked at a fixed tick rate with 'cron_due'.
+ * Initialize it with 'cron_tick_init'.
+ */
+typedef struct {
+    time_t last; // date of the last tick
+    time_t next; // first 'fire' date after 'last', '((time_t) -1)' if there is none
+    uint64_t missed; // 'fire' dates of the last due tick beyond the first one, because it was late
+} cron_tick_state;
+
+/**
+ * Initializes a tick state, the first tick covering the dates after 'now'.
+ *
+ * @param expr parsed cron expression to tick
+ * @param state state to initialize
+ * @param now date of the initialization
+ */
+void cron_tick_init(const cron_expr *expr, cron_tick_state *state, time_t now);
+
+/**
+ * Checks whether the expression fired in ]'state->last', 'now'] and moves the
+ * state to 'now'. Ticks before the next 'fire' date cost a single comparison;
+ * a due tick counts the 'fire' dates it covers into 'state->missed' and
+ * searches the next one. A clock set back keeps waiting for the pending
+ * 'fire' date; call 'cron_tick_init' again to follow it.
+ *
+ * @param expr parsed cron expression the state was initialized with
+ * @param state state initialized by 'cron_tick_init'
+ * @param now date of the tick
+ * @return 1 if one or more 'fire' dates passed since the last tick, 0 otherwise or in case of error.
+ */
+int cron_due(const cron_expr *expr, cron_tick_state *state, time_t now);
+
+/**
+ * Calculates the next 'fire' date of each of the specified expressions,
+ * the same as 'out[i] = cron_next(&exprs[i], from)'. The array is split
+ * into equal chunks computed by separate threads (pthreads), each writing
+ * its own part of 'out' only. Builds without pthreads, or defining
+ * CRON_NO_THREADS, compute all chunks in the calling thread.
+ *
+ * @param exprs parsed cron expressions
+ * @param n number of expressions
+ * @param from start date to start calculation from
+ * @param out receives the 'fire' dates, must hold 'n' dates
+ * @param threads number of threads to use including the calling one,
+ *        0 to use one per online CPU
+ */
+void cron_next_batch(const cron_expr *exprs, size_t n, time_t from, time_t *out, unsigned int threads);
+
+/**
+ * Allocator for the memory of tables and zones, e.g. an arena passed as ctx.
+ * alloc_fn returns size bytes aligned for any type, or NULL; free_fn releases
+ * memory returned by alloc_fn and is never called with NULL.
+ */
+typedef struct {
+    void *(*alloc_fn)(void *ctx, size_t size);
+    void (*free_fn)(void *ctx, void *ptr);
+    void *ctx;
+} cron_allocator;
+
+/**
+ * Sets the allocator used by the functions without an allocator parameter,
+ * by default malloc/free (cronMalloc/cronFree with -DCRON_TEST_MALLOC).
+ * Tables and zones are freed with the allocator they were created with.
+ * Not thread-safe, meant to be called before other threads use the library.
+ * 'cron_parse_expr' doesn't allocate memory.
+ *
+ * @param allocator allocator to copy, NULL restores the default
+ */
+void cron_set_allocator(const cron_allocator *allocator);
+
+/**
+ * Table of cron expressions, to find all expressions matching a date at once.
+ */
+typedef struct cron_table cron_table;
+
+/**
+ * Creates a table of the specified expressions, stored as one bitmap over
+ * all expressions per value of each field. Takes about 34 bytes per expression.
+ *
+ * @param exprs parsed cron expressions, copied into the table
+ * @param n number of expressions
+ * @return created table, to be freed using 'cron_table_free'. NULL is returned on error.
+ */
+cron_table *cron_table_create(const cron_expr *exprs, size_t n);
+
+/**
+ * Same as 'cron_table_create', allocating the table with the specified allocator.
+ *
+ * @param allocator allocator used for the table until it is freed, NULL for the one set by 'cron_set_allocator'
+ */
+cron_table *cron_table_create_ex(const cron_expr *exprs, size_t n, const cron_allocator *allocator);
+
+/**
+ * Frees a table created by 'cron_table_create'.
+ *
+ * @param table table to free, may be NULL
+ */
+void cron_table_free(cron_table *table);
+
+/**
+ * @param table table created by 'cron_table_create'
+ * @return number of expressions in the table
+ */
+size_t cron_table_count(const cron_table *table);
+
+/**
+ * Finds all expressions of a table for which the specified date is a 'fire'
+ * date, the same as calling 'cron_matches' for each of them. The fields of
+ * the date select one bitmap per field, which are combined with SSE2/AVX2
+ * when the compiler targets them.
+ *
+ * @param table table created by 'cron_table_create'
+ * @param date date to check
+ * @param bitmap receives one bit per expression, bit i % 64 of word i / 64
+ *        set if expression i matches; must hold (count + 63) / 64 words
+ * @return number of matching expressions
+ */
+size_t cron_table_match(const cron_table *table, time_t date, uint64_t *bitmap);
+
+/**
+ * Result of parsing a line of text with 'cron_parse_lines'.
+ */
+typedef struct {
+    size_t offset; /* byte offset of the line in the text */
+    size_t id_offset; /* byte offset of the text following the expression on the line, e.g. a job id */
+    size_t id_length; /* its length, without surrounding white space */
+    const char *error; /* error message as set by 'cron_parse_expr', NULL if the expression was parsed */
+} cron_line;
+
+/**
+ * Counts the lines of a text, the last one may lack a '\n'.
+ *
+ * @param data text
+ * @param len length of data in bytes
+ * @return number of lines
+ */
+size_t cron_count_lines(const char *data, size_t len);
+
+/**
+ * Parses a text with one expression per line, e.g. a file mapped with
+ * 'cron_file_map'. Each line starts with the 6 fields of an expression,
+ * separated by white space, followed by any other text like a job id.
+ * The text is split into chunks of whole lines parsed by separate threads
+ * (pthreads) like 'cron_next_batch', each writing its own part of 'exprs'
+ * and 'lines' only. The values for 'H' are taken from the hash settings
+ * once by the calling thread.
+ *
+ * @param data text, doesn't need to be nul-terminated
+ * @param len length of data in bytes
+ * @param exprs receives the expression of line i at index i; zeroed if the line has an error
+ * @param lines receives the offsets and error of line i at index i
+ * @param n number of elements of 'exprs' and 'lines', lines after the first 'n' are skipped;
+ *        'cron_count_lines' gives the number of lines
+ * @param threads number of threads to use including the calling one,
+ *        0 to use one per online CPU
+ * @return number of lines written, those with an error included
+ */
+size_t cron_parse_lines(const char *data, size_t len, cron_expr *exprs, cron_line *lines, size_t n,
+                        unsigned int threads);
+
+/**
+ * File mapped into memory read-only, or read if it can't be mapped.
+ */
+typedef struct cron_file cron_file;
+
+/**
+ * Maps a file into memory with mmap where available, reading it into memory
+ * allocated by the allocator set by 'cron_set_allocator' otherwise.
+ *
+ * @param path path of the file
+ * @param error output error message, will be set to string literal
+ *        error message in case of error. Will be set to NULL on success.
+ * @return mapped file, to be unmapped using 'cron_file_unmap'. NULL is returned on error.
+ */
+cron_file *cron_file_map(const char *path, const char **error);
+
+/**
+ * @param file file mapped by 'cron_file_map'
+ * @return contents of the file, not nul-terminated; may be NULL for an empty file
+ */
+const char *cron_file_data(const cron_file *file);
+
+/**
+ * @param file file mapped by 'cron_file_map'
+ * @return size of the file contents in bytes
+ */
+size_t cron_file_size(const cron_file *file);
+
+/**
+ * Unmaps a file mapped by 'cron_file_map'.
+ *
+ * @param file file to unmap, may be NULL
+ */
+void cron_file_unmap(cron_file *file);
+
+/**
+ * Entry of a crontab: a line with an expression and a command.
+ */
+typedef struct {
+    cron_expr expr; /* zeroed if the expression is invalid */
+    const char *text; /* the line without surrounding white space */
+    const char *command; /* the text following the expression */
+    size_t line; /* number of the line, from 1 */
+    const char *error; /* error message of an invalid expression, NULL if it is valid */
+} cron_crontab_entry;
+
+/**
+ * Change of a crontab reported by 'cron_crontab_update'.
+ */
+typedef enum {
+    CRON_CRONTAB_ADDED, /* new line */
+    CRON_CRONTAB_REMOVED, /* line gone */
+    CRON_CRONTAB_CHANGED /* new line with the command of a line gone */
+} cron_crontab_change;
+
+/**
+ * Function called for each change of a crontab.
+ * ctx: context passed to 'cron_crontab_update'
+ * change: kind of change
+ * old_entry: entry removed or changed, NULL if added; valid until the update returns
+ * new_entry: entry added or changed, NULL if removed
+ */
+typedef void (*cron_crontab_diff_fn)(void *ctx, cron_crontab_change change, const cron_crontab_entry *old_entry,
+                                     const cron_crontab_entry *new_entry);
+
+/**
+ * Entries of a crontab file, reloaded incrementally.
+ */
+typedef struct cron_crontab cron_crontab;
+
+/**
+ * Creates an empty crontab, allocated by the allocator set by 'cron_set_allocator'.
+ *
+ * @return created crontab, to be freed using 'cron_crontab_free'. NULL is returned on error.
+ */
+cron_crontab *cron_crontab_create(void);
+
+/**
+ * Frees a crontab created by 'cron_crontab_create'.
+ *
+ * @param tab crontab to free, may be NULL
+ */
+void cron_crontab_free(cron_crontab *tab);
+
+/**
+ * Replaces the entries of a crontab with the lines of a text in crontab
+ * format. Each line holds an expression and a command: 6 fields if they
+ * form a valid expression, 5 fields firing at second 0 otherwise, or a
+ * macro like '@daily' ('@reboot' isn't supported). Empty lines, comments
+ * starting with '#' and environment settings 'NAME=value' are skipped.
+ *
+ * Only lines whose text isn't an entry already are parsed, the other
+ * entries are kept, so reloading a file with a few lines changed takes
+ * time proportional to its size for hashing the lines, plus parsing
+ * of the changed lines.
+ *
+ * @param tab crontab created by 'cron_crontab_create'
+ * @param data text, doesn't need to be nul-terminated
+ * @param len length of data in bytes
+ * @param diff function called for each entry added, removed or changed, may be NULL
+ * @param ctx passed to diff
+ * @param error output error message, will be set to string literal
+ *        error message in case of error. Will be set to NULL on success.
+ *        Invalid expressions are not errors, see 'cron_crontab_entry'.
+ * @return 0 on success, -1 on error, leaving the crontab unchanged.
+ */
+int cron_crontab_update(cron_crontab *tab, const char *data, size_t len, cron_crontab_diff_fn diff, void *ctx,
+                        const char **error);
+
+/**
+ * Same as 'cron_crontab_update' with the contents of a file, mapped by 'cron_file_map'.
+ *
+ * @param path path of the crontab file
+ */
+int cron_crontab_load(cron_crontab *tab, const char *path, cron_crontab_diff_fn diff, void *ctx,
+                      const char **error);
+
+/**
+ * @param tab crontab created by 'cron_crontab_create'
+ * @return number of entries
+ */
+size_t cron_crontab_count(const cron_crontab *tab);
+
+/**
+ * @param tab crontab created by 'cron_crontab_create'
+ * @return entries in the order of their lines, valid until the next update
+ */
+const cron_crontab_entry *cron_crontab_entries(const cron_crontab *tab);
+
+/**
+ * Time zone loaded from a TZif file (RFC 8536), e.g. '/usr/share/zoneinfo/Europe/Berlin'.
+ * A loaded zone is read-only and can be shared between threads.
+ */
+typedef struct cron_zone cron_zone;
+
+/**
+ * Loads a time zone from a TZif file.
+ *
+ * @param path path of the TZif file
+ * @param error output error message, will be set to string literal
+ *        error message in case of error. Will be set to NULL on success.
+ * @return loaded zone, to be freed using 'cron_zone_free'. NULL is returned on error.
+ */
+cron_zone *cron_zone_load(const char *path, const char **error);
+
+/**
+ * Loads a time zone from the contents of a TZif file, same as 'cron_zone_load'.
+ *
+ * @param data TZif file contents, not referenced after the call
+ * @param len length of data in bytes
+ * @param error output error message as in 'cron_zone_load'
+ * @return loaded zone, to be freed using 'cron_zone_free'. NULL is returned on error.
+ */
+cron_zone *cron_zone_parse(const uint8_t *data, size_t len, const char **error);
+
+/**
+ * Same as 'cron_zone_load', allocating the zone and the file contents read
+ * with the specified allocator.
+ *
+ * @param allocator allocator used for the zone until it is freed, NULL for the one set by 'cron_set_allocator'
+ */
+cron_zone *cron_zone_load_ex(const char *path, const cron_allocator *allocator, const char **error);
+
+/**
+ * Same as 'cron_zone_parse', allocating the zone with the specified allocator.
+ *
+ * @param allocator allocator used for the zone until it is freed, NULL for the one set by 'cron_set_allocator'
+ */
+cron_zone *cron_zone_parse_ex(const uint8_t *data, size_t len, const cron_allocator *allocator, const char **error);
+
+/**
+ * Frees a zone loaded by 'cron_zone_load' or 'cron_zone_parse'.
+ *
+ * @param zone zone to free, may be NULL
+ */
+void cron_zone_free(cron_zone *zone);
+
+/**
+ * Calculates the UTC offset of a zone at the specified date.
+ *
+ * @param zone loaded zone
+ * @param date date to look up
+ * @return UTC offset in seconds, positive east of Greenwich; 0 if zone is NULL.
+ */
+int32_t cron_zone_offset(const cron_zone *zone, time_t date);
+
+/**
+ * Same as 'cron_next', with the expression evaluated in the wall-clock time
+ * of the specified zone, independently of the build mode and of the process
+ * time zone. The offset transitions of the zone are found by binary search.
+ *
+ * Wall-clock times skipped by a forward transition (start of daylight saving
+ * time) fire once, at the instant of the transition. Wall-clock times repeated
+ * by a backward transition (end of daylight saving time) fire only at their
+ * first occurrence.
+ *
+ * @param expr parsed cron expression to use in next date calculation
+ * @param zone loaded zone to evaluate the expression in
+ * @param date start date to start calculation from
+ * @return next 'fire' date in case of success, '((time_t) -1)' in case of error.
+ */
+time_t cron_next_tz(const cron_expr *expr, const cron_zone *zone, time_t date);
+
+#ifdef CRON_USE_LOCAL_TIME
+
+/**
+ * Takes a snapshot of the process time zone ('TZ' environment variable,
+ * '/etc/localtime' if it is not set) from its TZif file or POSIX TZ string.
+ * Until the next call, local dates are calculated from that snapshot, the
+ * same way as in 'cron_next_tz', instead of with 'localtime_r'/'mktime'.
+ * This avoids the libc time zone lock, so evaluations scale across threads.
+ * Call it again to pick up time zone changes. It must not be called while
+ * other threads are evaluating expressions.
+ *
+ * @return 0 on success, -1 if the time zone couldn't be loaded; the
+ *         previous snapshot (or 'localtime_r'/'mktime') is kept then.
+ */
+int cron_local_zone_refresh(void);
+
+/**
+ * Drops the snapshot taken by 'cron_local_zone_refresh', local dates are
+ * calculated with 'localtime_r'/'mktime' again. Must not be called while
+ * other threads are evaluating expressions.
+ */
+void cron_local_zone_clear(void);
+
+#endif /* CRON_USE_LOCAL_TIME */
+
+/**
+ * uint8_t* replace char* for storing hit dates, set_bit and get_bit are used as handlers.
+ * Call 'cron_classify' after changing the bits of a parsed expression.
  */
 uint8_t cron_getBit(const uint8_t *rbyte, unsigned int idx);
 
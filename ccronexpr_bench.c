@@ -0,0 +1,96 @@
+/*
+ * Benchmark of cron_next_batch: next 'fire' dates of a large array of
+ * expressions, computed with 1, 2, 4, ... threads up to the number of CPUs.
+ * Parsing the expressions from a text with one per line by cron_parse_lines
+ * is measured the same way.
+ *
+ * Usage: ccronexpr_bench [number of expressions]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ccronexpr.h"
+
+#define ARRAY_LEN(x) sizeof(x)/sizeof(x[0])
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    static const char *patterns[] = {
+            "*/15 * 1-4 * * *", "0 0 7 ? * MON-FRI", "0 30 23 30 1/3 ?", "0 0 0 L * ?", "0 0 0 LW * ?",
+            "0 0 0 ? * 5L", "0 0 0 29 2 ?", "0 0 12 13 * ?", "0 0 0 1W,15W * ?", "0 */5 * * * *"
+    };
+    size_t n = argc > 1 ? (size_t) strtoul(argv[1], NULL, 10) : 1000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    time_t from = 1341100430; /* 2012-07-01_00:00:30 */
+    cron_expr *exprs;
+    cron_line *lines;
+    char *text;
+    size_t len = 0;
+    time_t *out;
+    const char *err = NULL;
+    double base = 0;
+    unsigned int threads;
+    size_t i;
+    if (cpus < 1) cpus = 1;
+    exprs = (cron_expr *) malloc(n * sizeof(cron_expr));
+    out = (time_t *) malloc(n * sizeof(time_t));
+    lines = (cron_line *) malloc(n * sizeof(cron_line));
+    text = (char *) malloc(n * 32);
+    if (!exprs || !out || !lines || !text) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < n; i++) {
+        cron_parse_expr(patterns[i % ARRAY_LEN(patterns)], &exprs[i], &err);
+        if (err) {
+            fprintf(stderr, "Invalid expression %s: %s\n", patterns[i % ARRAY_LEN(patterns)], err);
+            return 1;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        len += (size_t) sprintf(text + len, "%s %lu\n", patterns[i % ARRAY_LEN(patterns)], (unsigned long) i);
+    }
+    printf("%lu expressions, %ld CPUs\n", (unsigned long) n, cpus);
+    printf("cron_parse_lines, %.1f MB:\n", (double) len / 1e6);
+    threads = 1;
+    for (;;) {
+        double start = now_seconds(), elapsed;
+        if (cron_parse_lines(text, len, exprs, lines, n, threads) != n) {
+            fprintf(stderr, "Lines missing\n");
+            return 1;
+        }
+        elapsed = now_seconds() - start;
+        if (1 == threads) base = elapsed;
+        printf("%3u threads: %8.3f ms, %6.1f MB/s, speedup %.2f\n", threads, elapsed * 1e3,
+               (double) len / 1e6 / elapsed, base / elapsed);
+        if (threads >= (unsigned int) cpus) break;
+        threads = threads * 2 < (unsigned int) cpus ? threads * 2 : (unsigned int) cpus;
+    }
+    printf("cron_next_batch:\n");
+    threads = 1;
+    for (;;) {
+        double start = now_seconds(), elapsed;
+        cron_next_batch(exprs, n, from, out, threads);
+        elapsed = now_seconds() - start;
+        if (1 == threads) base = elapsed;
+        printf("%3u threads: %8.3f ms, %6.1f ns per expression, speedup %.2f\n", threads, elapsed * 1e3,
+               elapsed * 1e9 / (double) n, base / elapsed);
+        if (threads >= (unsigned int) cpus) break;
+        threads = threads * 2 < (unsigned int) cpus ? threads * 2 : (unsigned int) cpus;
+    }
+    free(text);
+    free(lines);
+    free(out);
+    free(exprs);
+    return 0;
+}
@@ -21,6 +21,10 @@
  * Created on February 24, 2015, 9:36 AM
  */
 
+#if defined(__unix__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L /* setenv() and tzset() with strict C standards */
+#endif
+
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -203,6 +207,253 @@ bool check_next(const char *pattern, const char *initial, const char *expected)
     return true;
 }
 
+bool check_next_tm(const char *pattern, const char *initial, const char *expected) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    struct tm *calinit = poors_mans_strptime(initial);
+    struct tm calnext;
+    char buffer[21];
+    int res = cron_next_tm(&parsed, calinit, &calnext);
+    free(calinit);
+    if (0 != res) return false;
+    memset(buffer, 0, 21);
+    strftime(buffer, 20, DATE_FORMAT, &calnext);
+    // Same fields as the time_t round trip, with the day of week and day of year
+    time_t datenext = timegm(&calnext);
+    struct tm *calcheck = gmtime(&datenext);
+    if (0 != strcmp(expected, buffer) || calcheck->tm_wday != calnext.tm_wday || calcheck->tm_yday != calnext.tm_yday) {
+        printf("Pattern: %s\n", pattern);
+        printf("Initial: %s\n", initial);
+        printf("Expected: %s\n", expected);
+        printf("Actual: %s\n", buffer);
+        return false;
+    }
+    return true;
+}
+
+bool check_prev(const char *pattern, const char *initial, const char *expected) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+
+    struct tm *calinit = poors_mans_strptime(initial);
+    time_t dateinit = timegm(calinit);
+    free(calinit);
+    if (-1 == dateinit) return false;
+    time_t dateprev = cron_prev(&parsed, dateinit);
+    struct tm *calprev = gmtime(&dateprev);
+    if (calprev == NULL) return false;
+    char buffer[21];
+    memset(buffer, 0, 21);
+    strftime(buffer, 20, DATE_FORMAT, calprev);
+    if (0 != strcmp(expected, buffer)) {
+        printf("Pattern: %s\n", pattern);
+        printf("Initial: %s\n", initial);
+        printf("Expected previous: %s\n", expected);
+        printf("Actual: %s\n", buffer);
+        return false;
+    }
+    return true;
+}
+
+bool check_matches(const char *pattern, const char *date, int expected) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    struct tm *caldate = poors_mans_strptime(date);
+    time_t datecheck = timegm(caldate);
+    free(caldate);
+    int matches = cron_matches(&parsed, datecheck);
+    if (matches != expected || matches != (cron_next(&parsed, datecheck - 1) == datecheck)) {
+        printf("Pattern: %s\n", pattern);
+        printf("Date: %s\n", date);
+        printf("Expected match: %d\n", expected);
+        printf("Actual: %d\n", matches);
+        return false;
+    }
+    return true;
+}
+
+bool check_satisfiable(const char *pattern, int expected) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    int satisfiable = cron_satisfiable(&parsed);
+    if (satisfiable != expected || (!satisfiable && INVALID_INSTANT != cron_next(&parsed, 0)) ||
+        (!satisfiable && INVALID_INSTANT != cron_prev(&parsed, 0))) {
+        printf("Pattern: %s\n", pattern);
+        printf("Expected satisfiable: %d\n", expected);
+        printf("Actual: %d\n", satisfiable);
+        return false;
+    }
+    return true;
+}
+
+/* Minimal TZif version 2 file without transitions: one time type and a POSIX TZ footer */
+static size_t make_tzif(uint8_t *buf, int32_t utoff, const char *footer) {
+    size_t len = 0;
+    int i;
+    for (i = 0; i < 2; i++) {
+        memset(buf + len, 0, 44);
+        memcpy(buf + len, "TZif2", 5);
+        buf[len + 39] = 1; /* typecnt */
+        buf[len + 43] = 4; /* charcnt */
+        len += 44;
+        buf[len++] = (uint8_t) ((uint32_t) utoff >> 24);
+        buf[len++] = (uint8_t) ((uint32_t) utoff >> 16);
+        buf[len++] = (uint8_t) ((uint32_t) utoff >> 8);
+        buf[len++] = (uint8_t) utoff;
+        buf[len++] = 0;
+        buf[len++] = 0;
+        memcpy(buf + len, "XXX", 4);
+        len += 4;
+    }
+    buf[len++] = '\n';
+    memcpy(buf + len, footer, strlen(footer));
+    len += strlen(footer);
+    buf[len++] = '\n';
+    return len;
+}
+
+bool check_next_tz(const cron_zone *zone, const char *pattern, const char *initial, const char *expected) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    struct tm *calinit = poors_mans_strptime(initial);
+    time_t dateinit = timegm(calinit);
+    free(calinit);
+    time_t datenext = cron_next_tz(&parsed, zone, dateinit);
+    struct tm *calnext = gmtime(&datenext);
+    if (calnext == NULL) return false;
+    char buffer[21];
+    memset(buffer, 0, 21);
+    strftime(buffer, 20, DATE_FORMAT, calnext);
+    if (0 != strcmp(expected, buffer)) {
+        printf("Pattern: %s\n", pattern);
+        printf("Initial: %s\n", initial);
+        printf("Expected: %s\n", expected);
+        printf("Actual: %s\n", buffer);
+        return false;
+    }
+    return true;
+}
+
+bool check_fill_range(const char *pattern, const char *from, const char *to, size_t cap) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    struct tm *calfrom = poors_mans_strptime(from);
+    struct tm *calto = poors_mans_strptime(to);
+    time_t datefrom = timegm(calfrom);
+    time_t dateto = timegm(calto);
+    free(calfrom);
+    free(calto);
+    time_t *dates = (time_t *) malloc(cap * sizeof(time_t));
+    size_t count = cron_fill_range(&parsed, datefrom, dateto, dates, cap);
+    bool ok = count <= cap;
+    size_t i;
+    time_t cur = datefrom;
+    for (i = 0; ok && i < count; i++) {
+        cur = cron_next(&parsed, cur);
+        ok = cur == dates[i];
+    }
+    if (ok && count < cap) {
+        /* Buffer not full: no fire date left in the range */
+        cur = cron_next(&parsed, cur);
+        ok = INVALID_INSTANT == cur || cur > dateto;
+    }
+    if (!ok) {
+        printf("Pattern: %s\n", pattern);
+        printf("Range: %s - %s, capacity %lu\n", from, to, (unsigned long) cap);
+        printf("Mismatch after %lu of %lu dates\n", (unsigned long) i, (unsigned long) count);
+    }
+    free(dates);
+    return ok;
+}
+
+bool check_count(const char *pattern, const char *from, const char *to) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    struct tm *calfrom = poors_mans_strptime(from);
+    struct tm *calto = poors_mans_strptime(to);
+    time_t datefrom = timegm(calfrom);
+    time_t dateto = timegm(calto);
+    free(calfrom);
+    free(calto);
+    int64_t expected = 0;
+    time_t cur = cron_next(&parsed, datefrom);
+    while (INVALID_INSTANT != cur && cur <= dateto) {
+        expected++;
+        cur = cron_next(&parsed, cur);
+    }
+    int64_t count = cron_count(&parsed, datefrom, dateto);
+    if (count != expected) {
+        printf("Pattern: %s\n", pattern);
+        printf("Range: %s - %s\n", from, to);
+        printf("Expected count: %lld\n", (long long) expected);
+        printf("Actual: %lld\n", (long long) count);
+        return false;
+    }
+    return true;
+}
+
+bool check_nth(const char *pattern, const char *from, uint64_t k) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    struct tm *calfrom = poors_mans_strptime(from);
+    time_t expected = timegm(calfrom);
+    free(calfrom);
+    time_t datefrom = expected;
+    uint64_t i;
+    for (i = 0; i < k && INVALID_INSTANT != expected; i++) {
+        expected = cron_next(&parsed, expected);
+    }
+    time_t nth = cron_nth(&parsed, datefrom, k);
+    if (nth != expected) {
+        printf("Pattern: %s\n", pattern);
+        printf("From: %s, k: %llu\n", from, (unsigned long long) k);
+        printf("Expected: %lld\n", (long long) expected);
+        printf("Actual: %lld\n", (long long) nth);
+        return false;
+    }
+    return true;
+}
+
 bool check_same(const char *expr1, const char *expr2) {
     cron_expr parsed1;
     cron_parse_expr(expr1, &parsed1, NULL);
@@ -533,6 +784,720 @@ void test_expr() {
     // check 1st february 2025
     assert(check_next("0 0 12 1,15 * ?", "2025-01-31_12:00:00", "2025-02-01_12:00:00"));
     assert(check_next("0 0 12 1W,15W * ?", "2025-01-31_12:00:00", "2025-02-03_12:00:00"));
+    // Century years and dates before 1970
+    assert(check_next("0 0 0 L 2 ?",            "2000-02-01_00:00:00", "2000-02-29_00:00:00"));
+    assert(check_next("0 0 0 L 2 ?",            "2100-02-01_00:00:00", "2100-02-28_00:00:00"));
+    assert(check_next("0 0 0 1 3 ?",            "2100-02-28_00:00:00", "2100-03-01_00:00:00"));
+    assert(check_next("0 0 12 ? * MON",         "1969-12-31_00:00:00", "1970-01-05_12:00:00"));
+    assert(check_next("0 0 0 LW * ?",           "1960-01-01_00:00:00", "1960-01-29_00:00:00"));
+    assert(check_next("59 59 23 31 12 ?",       "1969-12-31_23:59:58", "1969-12-31_23:59:59"));
+    // Expressions without day constraints, with and without a fixed period
+    assert(check_next("7/10 * * * * *",         "2012-12-31_23:59:57", "2013-01-01_00:00:07"));
+    assert(check_next("30 */15 * * * *",        "2012-07-01_09:45:30", "2012-07-01_10:00:30"));
+    assert(check_next("0 0 */6 * * ?",          "2012-07-01_18:00:00", "2012-07-02_00:00:00"));
+    assert(check_next("0 30 5 * * ?",           "1969-12-31_05:30:00", "1970-01-01_05:30:00"));
+    assert(check_next("*/7 * * * * *",          "2012-12-31_23:59:56", "2013-01-01_00:00:00"));
+    assert(check_next("0 10,50 1-4 * * *",      "2012-07-01_04:50:00", "2012-07-02_01:10:00"));
+    assert(check_next("0 10,50 1-4 * * *",      "2012-07-01_02:10:00", "2012-07-01_02:50:00"));
+    assert(check_next("15 0 0,12 * * *",        "1969-12-31_12:00:15", "1970-01-01_00:00:15"));
+    // Day search skipping whole months, to the same day of month a year later
+    assert(check_next("0 48/52 15 LW 6 *",      "1979-06-30_01:04:33", "1980-06-30_15:48:00"));
+    assert(check_next("0 0 12 29 2 ?",          "2012-02-29_13:00:00", "2016-02-29_12:00:00"));
+    assert(check_next("0 0 0 ? 2 5L",           "2023-02-25_00:00:00", "2024-02-23_00:00:00"));
+    // Sparse expressions, searched from the month down
+    assert(check_next("59 59 23 31 12 ?",       "2012-12-31_23:59:59", "2013-12-31_23:59:59"));
+    assert(check_next("59 59 23 31 12 ?",       "2012-12-31_23:59:58", "2012-12-31_23:59:59"));
+    assert(check_next("0 0 12 15 6 ?",          "2012-06-15_12:00:00", "2013-06-15_12:00:00"));
+    assert(check_next("0 0 12 15 6 ?",          "2012-06-15_11:59:59", "2012-06-15_12:00:00"));
+    assert(check_next("*/10 * * ? 2 MON",       "2012-02-27_23:59:55", "2013-02-04_00:00:00"));
+    assert(check_next("*/10 * * ? 2 MON",       "2012-02-27_23:59:45", "2012-02-27_23:59:50"));
+    assert(check_next("0 0 0 1 1 ?",            "1969-12-31_23:59:58", "1970-01-01_00:00:00"));
+    assert(check_next("0 0 0 1 1 ?",            "1969-01-01_00:00:00", "1970-01-01_00:00:00"));
+    // Further apart than 5 years
+    assert(check_next("0 0 0 29 2 ?",           "2096-02-29_00:00:00", "2104-02-29_00:00:00"));
+    assert(check_next("0 30 12 29 2 ?",         "2097-01-01_00:00:00", "2104-02-29_12:30:00"));
+    // Broken-down dates, normalized like timegm()
+    assert(check_next_tm("*/15 * 1-4 * * *",       "2012-07-01_09:53:50", "2012-07-02_01:00:00"));
+    assert(check_next_tm("0 0 0 29 2 ?",           "2096-02-29_00:00:00", "2104-02-29_00:00:00"));
+    assert(check_next_tm("0 0 7 ? * MON-FRI",      "2009-09-26_00:42:55", "2009-09-28_07:00:00"));
+    assert(check_next_tm("0 0 1 LW * ?",           "2022-07-29_01:00:00", "2022-08-31_01:00:00"));
+    assert(check_next_tm("0 */15 * * * *",         "2012-06-31_23:59:59", "2012-07-02_00:00:00"));
+}
+
+void test_prev() {
+    assert(check_prev("* * * * * *",            "2012-07-01_09:00:00", "2012-07-01_09:00:00"));
+    assert(check_prev("0 * * * * *",            "2012-07-01_09:00:59", "2012-07-01_09:00:00"));
+    assert(check_prev("0 0 * * * *",            "2012-07-01_09:30:00", "2012-07-01_09:00:00"));
+    assert(check_prev("*/15 * 1-4 * * *",       "2012-07-01_09:53:50", "2012-07-01_04:59:45"));
+    assert(check_prev("0 0 0 * * *",            "2012-07-01_00:00:00", "2012-07-01_00:00:00"));
+    assert(check_prev("0 0 0 1 * *",            "2012-02-29_23:59:59", "2012-02-01_00:00:00"));
+    assert(check_prev("0 0 0 31 * *",           "2012-07-01_00:00:00", "2012-05-31_00:00:00"));
+    assert(check_prev("0 0 7 ? * MON-FRI",      "2009-09-28_06:59:59", "2009-09-25_07:00:00"));
+    assert(check_prev("0 30 23 30 1/3 ?",       "2011-07-30_23:29:59", "2011-04-30_23:30:00"));
+    assert(check_prev("0 0 0 29 2 ?",           "2013-01-01_00:00:00", "2012-02-29_00:00:00"));
+    assert(check_prev("59 59 23 31 12 ?",       "2013-01-01_00:00:00", "2012-12-31_23:59:59"));
+    assert(check_prev("0 0 1 L * ?",            "2022-03-15_00:00:00", "2022-02-28_01:00:00"));
+    assert(check_prev("0 0 1 L-3 * ?",          "2020-02-27_00:00:00", "2020-02-26_01:00:00"));
+    assert(check_prev("0 0 1 LW * ?",           "2022-08-01_00:00:00", "2022-07-29_01:00:00"));
+    assert(check_prev("0 0 1 ? * 5L",           "2022-07-28_00:00:00", "2022-06-24_01:00:00"));
+    assert(check_prev("0 0 1 ? * 1L",           "2022-04-25_00:59:59", "2022-03-28_01:00:00"));
+    assert(check_prev("0 0 0 15W * ?",          "2022-05-20_00:00:00", "2022-05-16_00:00:00"));
+    assert(check_prev("0 0 0 1W * ?",           "2025-02-02_00:00:00", "2025-01-01_00:00:00"));
+    assert(check_prev("0 0 0 1W,15W,LW * *",    "2023-04-28_00:00:00", "2023-04-28_00:00:00"));
+    assert(check_prev("0 0 0 1W,15W,LW * *",    "2023-04-27_23:59:59", "2023-04-14_00:00:00"));
+    assert(check_prev("0 0 0 L 2 ?",            "2100-12-31_00:00:00", "2100-02-28_00:00:00"));
+    assert(check_prev("0 0 12 L 6 ?",           "1980-06-30_11:00:00", "1979-06-30_12:00:00"));
+    assert(check_prev("0 0 12 29 2 ?",          "2016-02-29_11:00:00", "2012-02-29_12:00:00"));
+    assert(check_prev("0 0 0 29 2 ?",           "2104-02-28_23:59:59", "2096-02-29_00:00:00"));
+    assert(check_prev("0 30 * 29 2 ?",          "2104-02-29_00:29:59", "2096-02-29_23:30:00"));
+}
+
+/* Instants beyond the years of an int can't be represented, like with gmtime_r() */
+void test_limits() {
+    cron_expr parsed;
+    const char *err = NULL;
+    time_t out[4];
+    const time_t max = (time_t) INT64_MAX;
+    const time_t min = (time_t) INT64_MIN;
+    if (sizeof(time_t) < 8) return;
+    cron_parse_expr("0 0 12 ? * MON-FRI", &parsed, &err);
+    assert(INVALID_INSTANT == cron_next(&parsed, max - 1));
+    assert(INVALID_INSTANT == cron_next(&parsed, max));
+    assert(INVALID_INSTANT == cron_next(&parsed, min));
+    assert(INVALID_INSTANT == cron_prev(&parsed, max));
+    assert(INVALID_INSTANT == cron_prev(&parsed, min));
+    assert(INVALID_INSTANT == cron_prev(&parsed, min + 1));
+    assert(!cron_matches(&parsed, max));
+    assert(!cron_matches(&parsed, min));
+    assert(0 == cron_fill_range(&parsed, max - 1, max, out, 4));
+    // Last second of the year INT_MAX
+    assert(INVALID_INSTANT != cron_prev(&parsed, (time_t) INT64_C(67767976233532799)));
+    // First second of the year INT_MIN, the previous fire time falls before it
+    assert(INVALID_INSTANT == cron_prev(&parsed, (time_t) INT64_C(-67768100567971200)));
+    cron_parse_expr("0 0 0 29 2 ?", &parsed, &err);
+    assert(INVALID_INSTANT == cron_next(&parsed, max - 1));
+    assert(INVALID_INSTANT == cron_next(&parsed, max));
+    assert(INVALID_INSTANT == cron_next(&parsed, min));
+    assert(INVALID_INSTANT == cron_prev(&parsed, max));
+    assert(INVALID_INSTANT == cron_prev(&parsed, min));
+    assert(INVALID_INSTANT == cron_prev(&parsed, (time_t) INT64_C(-67768100567971200)));
+    cron_parse_expr("*/5 * * * * *", &parsed, &err);
+    assert(INVALID_INSTANT == cron_next(&parsed, max - 1));
+    assert(INVALID_INSTANT == cron_next(&parsed, max));
+    assert(INVALID_INSTANT == cron_next(&parsed, min));
+    cron_parse_expr("0 30 1,2,13 * * *", &parsed, &err);
+    assert(INVALID_INSTANT == cron_next(&parsed, max - 1));
+    assert(INVALID_INSTANT == cron_next(&parsed, max));
+    assert(INVALID_INSTANT == cron_next(&parsed, min));
+    cron_parse_expr("0 0 0 1 * ?", &parsed, &err);
+#ifndef CRON_USE_LOCAL_TIME
+    assert(-1 == cron_count(&parsed, (time_t) INT64_C(67767976233316800), max));
+    assert(-1 == cron_count(&parsed, min, 0));
+#endif
+    assert(0 == cron_count(&parsed, (time_t) INT64_C(67767976233316800), (time_t) INT64_C(67767976233532799)));
+    assert(INVALID_INSTANT == cron_nth(&parsed, (time_t) INT64_C(67767976233316800), 1));
+    assert(INVALID_INSTANT == cron_nth(&parsed, max - 1, 1));
+    assert(INVALID_INSTANT == cron_nth(&parsed, max, 1));
+    assert(INVALID_INSTANT == cron_nth(&parsed, min, 1));
+}
+
+/* Parse expression with and without cache, the results must be the same */
+static int check_cached(cron_parse_cache *cache, const char *expression) {
+    cron_expr parsed, cached;
+    const char *err = NULL;
+    const char *cached_err = NULL;
+    memset(&cached, 0xAB, sizeof(cached));
+    cron_parse_expr(expression, &parsed, &err);
+    cron_parse_expr_cached(cache, expression, &cached, &cached_err);
+    if (err || cached_err) return err && cached_err;
+    return 0 == memcmp(&parsed, &cached, sizeof(cron_expr));
+}
+
+void test_parse_cache() {
+    cron_parse_cache *cache = cron_parse_cache_create(4);
+    assert(cache && 0 == cron_parse_cache_count(cache));
+    assert(check_cached(cache, "0 0 * * * *"));
+    assert(check_cached(cache, "0 0 * * * *"));
+    assert(check_cached(cache, "  0  0\t* * *   * "));
+    assert(1 == cron_parse_cache_count(cache));
+    // Invalid expressions are not cached
+    assert(check_cached(cache, "0 0 * * *"));
+    assert(check_cached(cache, "0 0 77 * * *"));
+    assert(1 == cron_parse_cache_count(cache));
+    // 'H' is keyed with the hash seed
+    cron_init_hash(3);
+    assert(check_cached(cache, "H H 1 * * ?"));
+    cron_init_hash(5);
+    assert(check_cached(cache, "H H 1 * * ?"));
+    assert(check_cached(cache, "H  H 1 * * ?"));
+    cron_init_hash(7);
+    assert(3 == cron_parse_cache_count(cache));
+    assert(check_cached(cache, "0 0 12 ? * MON-FRI"));
+    // Full cache parses without adding
+    assert(check_cached(cache, "0 0 0 L * ?"));
+    assert(check_cached(cache, "0 0 0 L * ?"));
+    assert(4 == cron_parse_cache_count(cache));
+    assert(check_cached(NULL, "0 0 0 L * ?"));
+    cron_parse_cache_free(cache);
+    assert(!cron_parse_cache_create(0));
+}
+
+void test_parse_lines() {
+    static const char *patterns[] = {
+            "0 0 * * * *", "*/15 * 1-4 * * *", "0 0 7 ? * MON-FRI", "H H 1 * * ?", "0 0 0 LW * ?", "0 0 0 ? * 5L"
+    };
+    static const char text[] = "0 0 * * * * job-1\n"
+                               "\t*/15  *\t1-4 * * *   job 2 \r\n"
+                               "\n"
+                               "0 0 77 * * * job-4\n"
+                               "0 0 * * *\n"
+                               "H H 1 * * ?";
+    size_t n = 5000, i, count, len = 0;
+    char *big = (char *) malloc(n * 32);
+    cron_expr *exprs = (cron_expr *) malloc(n * sizeof(cron_expr));
+    cron_line *lines = (cron_line *) malloc(n * sizeof(cron_line));
+    cron_expr expected;
+    const char *err = NULL;
+    FILE *out;
+    cron_file *file;
+    assert(big && exprs && lines);
+    cron_init_hash(11);
+
+    assert(6 == cron_count_lines(text, sizeof(text) - 1));
+    assert(6 == cron_parse_lines(text, sizeof(text) - 1, exprs, lines, n, 1));
+    cron_parse_expr("0 0 * * * *", &expected, &err);
+    assert(!lines[0].error && 0 == memcmp(&expected, &exprs[0], sizeof(cron_expr)));
+    assert(0 == lines[0].offset && 0 == strncmp(text + lines[0].id_offset, "job-1", lines[0].id_length));
+    cron_parse_expr("*/15 * 1-4 * * *", &expected, &err);
+    assert(!lines[1].error && 0 == memcmp(&expected, &exprs[1], sizeof(cron_expr)));
+    assert(5 == lines[1].id_length && 0 == strncmp(text + lines[1].id_offset, "job 2", 5));
+    assert(lines[2].error && 0 == lines[2].id_length);
+    assert(lines[3].error && 0 == strncmp(text + lines[3].id_offset, "job-4", lines[3].id_length));
+    assert(lines[4].error);
+    cron_parse_expr("H H 1 * * ?", &expected, &err);
+    assert(!lines[5].error && 0 == memcmp(&expected, &exprs[5], sizeof(cron_expr)));
+    assert(sizeof(text) - 1 == lines[5].id_offset && 0 == lines[5].id_length);
+    // Lines after n are skipped
+    assert(2 == cron_parse_lines(text, sizeof(text) - 1, exprs, lines, 2, 1));
+
+    // Several chunks
+    for (i = 0; i < n; i++) {
+        len += (size_t) sprintf(big + len, "%s %lu\n", patterns[i % ARRAY_LEN(patterns)], (unsigned long) i);
+    }
+    assert(n == cron_count_lines(big, len));
+    count = cron_parse_lines(big, len, exprs, lines, n, 4);
+    assert(n == count);
+    for (i = 0; i < n; i++) {
+        cron_parse_expr(patterns[i % ARRAY_LEN(patterns)], &expected, &err);
+        assert(!lines[i].error && 0 == memcmp(&expected, &exprs[i], sizeof(cron_expr)));
+        assert(strtoul(big + lines[i].id_offset, NULL, 10) == i);
+    }
+
+    out = fopen("ccronexpr_test_lines.txt", "wb");
+    assert(out && len == fwrite(big, 1, len, out));
+    fclose(out);
+    file = cron_file_map("ccronexpr_test_lines.txt", &err);
+    assert(file && !err && len == cron_file_size(file));
+    assert(n == cron_parse_lines(cron_file_data(file), cron_file_size(file), exprs, lines, n, 0));
+    assert(!lines[n - 1].error && strtoul(cron_file_data(file) + lines[n - 1].id_offset, NULL, 10) == n - 1);
+    cron_file_unmap(file);
+    remove("ccronexpr_test_lines.txt");
+    assert(!cron_file_map("/nonexistent/lines", &err) && err);
+
+    free(lines);
+    free(exprs);
+    free(big);
+}
+
+typedef struct {
+    int added, removed, changed;
+    const char *last; /* command of the last change */
+} crontab_changes;
+
+static void count_change(void *ctx, cron_crontab_change change, const cron_crontab_entry *old_entry,
+                         const cron_crontab_entry *new_entry) {
+    crontab_changes *changes = (crontab_changes *) ctx;
+    switch (change) {
+        case CRON_CRONTAB_ADDED:
+            assert(!old_entry && new_entry);
+            changes->added++;
+            changes->last = new_entry->command;
+            break;
+        case CRON_CRONTAB_REMOVED:
+            assert(old_entry && !new_entry);
+            changes->removed++;
+            changes->last = old_entry->command;
+            break;
+        case CRON_CRONTAB_CHANGED:
+            assert(old_entry && new_entry && 0 == strcmp(old_entry->command, new_entry->command));
+            changes->changed++;
+            changes->last = new_entry->command;
+            break;
+    }
+}
+
+/* Check the expression of a crontab entry */
+static int check_entry(const cron_crontab_entry *entry, const char *pattern, const char *command) {
+    cron_expr expected;
+    const char *err = NULL;
+    cron_parse_expr(pattern, &expected, &err);
+    return !err && !entry->error && 0 == memcmp(&expected, &entry->expr, sizeof(cron_expr)) &&
+           0 == strcmp(entry->command, command);
+}
+
+void test_crontab() {
+    static const char tab1[] = "# m h dom mon dow command\n"
+                               "SHELL=/bin/sh\n"
+                               "\n"
+                               "*/5 * * * * /usr/bin/poll --all\n"
+                               "  30 0 7 ? * MON-FRI   backup.sh  \n"
+                               "@daily rotate-logs\n"
+                               "0 0 77 * * cleanup\n"
+                               "@reboot start";
+    static const char tab2[] = "MAILTO=root\n"
+                               "# m h dom mon dow command\n"
+                               "*/5 * * * * /usr/bin/poll --all\n"
+                               "0 0 8 ? * MON-FRI backup.sh\n"
+                               "@daily rotate-logs\n"
+                               "0 0 1 * * report\n"
+                               "@reboot start";
+    crontab_changes changes = {0, 0, 0, NULL};
+    const cron_crontab_entry *entries;
+    const char *rotate;
+    const char *err = NULL;
+    cron_crontab *tab = cron_crontab_create();
+    assert(tab && 0 == cron_crontab_count(tab));
+
+    assert(0 == cron_crontab_update(tab, tab1, sizeof(tab1) - 1, count_change, &changes, &err) && !err);
+    assert(5 == changes.added && 0 == changes.removed && 0 == changes.changed);
+    assert(5 == cron_crontab_count(tab));
+    entries = cron_crontab_entries(tab);
+    assert(check_entry(&entries[0], "0 */5 * * * *", "/usr/bin/poll --all") && 4 == entries[0].line);
+    assert(check_entry(&entries[1], "30 0 7 ? * MON-FRI", "backup.sh") && 5 == entries[1].line);
+    assert(check_entry(&entries[2], "0 0 0 * * *", "rotate-logs"));
+    assert(entries[3].error && 0 == strcmp("0 0 77 * * cleanup", entries[3].text));
+    assert(entries[4].error && 0 == strcmp("start", entries[4].command));
+    rotate = entries[2].text;
+
+    // Unchanged lines are kept as they are, even when they move
+    changes.added = 0;
+    assert(0 == cron_crontab_update(tab, tab2, sizeof(tab2) - 1, count_change, &changes, &err) && !err);
+    assert(1 == changes.added && 1 == changes.removed && 1 == changes.changed);
+    assert(5 == cron_crontab_count(tab));
+    entries = cron_crontab_entries(tab);
+    assert(check_entry(&entries[1], "0 0 8 ? * MON-FRI", "backup.sh") && 4 == entries[1].line);
+    assert(rotate == entries[2].text && 5 == entries[2].line);
+    assert(check_entry(&entries[3], "0 0 0 1 * *", "report"));
+
+    changes.added = changes.removed = changes.changed = 0;
+    assert(0 == cron_crontab_update(tab, tab2, sizeof(tab2) - 1, count_change, &changes, &err));
+    assert(0 == changes.added && 0 == changes.removed && 0 == changes.changed);
+    assert(0 == cron_crontab_update(tab, "", 0, count_change, &changes, &err));
+    assert(5 == changes.removed && 0 == cron_crontab_count(tab));
+    assert(0 != cron_crontab_load(tab, "/nonexistent/crontab", NULL, NULL, &err) && err);
+    cron_crontab_free(tab);
+}
+
+void test_satisfiable() {
+    assert(check_satisfiable("0 0 0 30 2 ?",           0));
+    assert(check_satisfiable("0 0 0 31 FEB ?",         0));
+    assert(check_satisfiable("0 0 0 31 4,6,9,11 ?",    0));
+    assert(check_satisfiable("0 0 0 30W 2 ?",          0));
+    assert(check_satisfiable("0 0 0 29 2 ?",           1));
+    assert(check_satisfiable("0 0 0 29,30 2 ?",        1));
+    assert(check_satisfiable("0 0 0 31 4,5 ?",         1));
+    assert(check_satisfiable("0 0 0 L 2 ?",            1));
+    assert(check_satisfiable("0 0 0 ? 2 5L",           1));
+    assert(check_satisfiable("0 0 0 1W,15W,LW * *",    1));
+    assert(check_satisfiable("* * * * * *",            1));
+}
+
+void test_classify() {
+    cron_expr parsed;
+    const char *err = NULL;
+    time_t date = 1341100800; // 2012-07-01_00:00:00
+    cron_parse_expr("0 0 0 30 2 ?", &parsed, &err);
+    assert(!cron_satisfiable(&parsed));
+    // 30th of March instead of February
+    cron_delBit(parsed.months, 1);
+    cron_setBit(parsed.months, 2);
+    cron_classify(&parsed);
+    assert(cron_satisfiable(&parsed));
+    assert(1364601600 == cron_next(&parsed, date)); // 2013-03-30_00:00:00
+    // Every 5 seconds to every 5 and 7 seconds: no longer a fixed period
+    cron_parse_expr("*/5 * * * * *", &parsed, &err);
+    cron_setBit(parsed.seconds, 7);
+    cron_classify(&parsed);
+    assert(date + 5 == cron_next(&parsed, date));
+    assert(date + 7 == cron_next(&parsed, date + 5));
+}
+
+void test_cursor() {
+    cron_expr parsed;
+    cron_cursor cursor;
+    const char *err = NULL;
+    time_t date;
+    cron_parse_expr("0 */15 * * * *", &parsed, &err);
+    assert(!err);
+    cron_cursor_init(&cursor, &parsed);
+    // Polling with an increasing date, across fire dates
+    for (date = 1341100000; date < 1341100000 + 7200; date += 7) {
+        assert(cron_cursor_next(&cursor, date) == cron_next(&parsed, date));
+    }
+    // Clock set back
+    assert(cron_cursor_next(&cursor, 1341100000) == cron_next(&parsed, 1341100000));
+    assert(cursor.from == 1341100000);
+    // Cached answer
+    assert(cron_cursor_next(&cursor, 1341100001) == cron_next(&parsed, 1341100000));
+    assert(cursor.from == 1341100000);
+    cron_parse_expr("0 0 0 30 2 ?", &parsed, &err);
+    assert(!err);
+    cron_cursor_init(&cursor, &parsed);
+    assert(INVALID_INSTANT == cron_cursor_next(&cursor, 1341100000));
+    assert(INVALID_INSTANT == cron_cursor_next(&cursor, 1341200000));
+}
+
+void test_due() {
+    cron_expr parsed;
+    cron_tick_state state;
+    const char *err = NULL;
+    time_t now = 1341100800; // 2012-07-01_00:00:00
+    int due = 0;
+    cron_parse_expr("0 */15 * * * *", &parsed, &err);
+    assert(!err);
+    cron_tick_init(&parsed, &state, now);
+    assert(state.next == now + 900);
+    // Ticks every 10 seconds: due once at each fire date
+    for (now += 10; now <= 1341100800 + 3600; now += 10) {
+        int res = cron_due(&parsed, &state, now);
+        assert(res == (0 == now % 900));
+        assert(0 == state.missed);
+        due += res;
+    }
+    assert(4 == due);
+    // Late tick covering 3 fire dates: one due tick, 2 missed
+    now = 1341100800 + 3600 + 3 * 900 + 10;
+    assert(1 == cron_due(&parsed, &state, now));
+    assert(2 == state.missed);
+    assert(state.next == 1341100800 + 3600 + 4 * 900);
+    assert(0 == cron_due(&parsed, &state, now + 1));
+    cron_parse_expr("0 0 0 30 2 ?", &parsed, &err);
+    assert(!err);
+    cron_tick_init(&parsed, &state, now);
+    assert(0 == cron_due(&parsed, &state, now + 100000000));
+    assert(0 == cron_due(NULL, &state, now));
+    assert(0 == cron_due(&parsed, NULL, now));
+}
+
+bool check_stream_match(const char *pattern, time_t from, time_t step, size_t n) {
+    const char *err = NULL;
+    cron_expr parsed;
+    cron_parse_expr(pattern, &parsed, &err);
+    if (err) {
+        printf("Error: %s\nPattern: %s\n", err, pattern);
+        return false;
+    }
+    time_t *dates = (time_t *) malloc(n * sizeof(time_t));
+    uint8_t *matches = (uint8_t *) malloc(n);
+    time_t *nexts = (time_t *) malloc(n * sizeof(time_t));
+    size_t count = 0;
+    size_t i;
+    bool ok = true;
+    // Irregular steps, with repeated dates and dates on fire dates
+    for (i = 0; i < n; i++) {
+        from += (time_t) (i * 7919 % (size_t) step);
+        dates[i] = i % 5 == 4 ? cron_next(&parsed, dates[i - 1]) : from;
+        if (dates[i] > from) from = dates[i];
+    }
+    size_t res = cron_stream_match(&parsed, dates, n, matches, nexts);
+    for (i = 0; i < n && ok; i++) {
+        count += matches[i];
+        if (matches[i] != cron_matches(&parsed, dates[i]) || nexts[i] != cron_next(&parsed, dates[i])) {
+            printf("Pattern: %s\n", pattern);
+            printf("Date: %ld\n", (long) dates[i]);
+            printf("Expected: %d %ld\n", cron_matches(&parsed, dates[i]), (long) cron_next(&parsed, dates[i]));
+            printf("Actual: %d %ld\n", matches[i], (long) nexts[i]);
+            ok = false;
+        }
+    }
+    if (ok && res != count) {
+        printf("Pattern: %s\nExpected count: %lu\nActual: %lu\n", pattern, (unsigned long) count, (unsigned long) res);
+        ok = false;
+    }
+    free(dates);
+    free(matches);
+    free(nexts);
+    return ok;
+}
+
+void test_stream_match() {
+    assert(check_stream_match("* * * * * *",             1341100000, 3, 1000));
+    assert(check_stream_match("0 */15 * * * *",          1341100000, 200, 1000));
+    assert(check_stream_match("*/20 0,30 9-17 ? * MON-FRI", 1341100000, 1000, 2000));
+    assert(check_stream_match("0 0 12 L * ?",            1341100000, 86400, 1000));
+    assert(check_stream_match("0 0 0 1W,15W,LW * *",     1341100000, 50000, 1000));
+    assert(check_stream_match("0 0 0 29 2 ?",            -100000000, 2000000, 500));
+    assert(check_stream_match("0 0 0 30 2 ?",            1341100000, 1000, 100));
+}
+
+void test_matches() {
+    assert(check_matches("* * * * * *",            "2012-07-01_09:00:00", 1));
+    assert(check_matches("*/15 * 1-4 * * *",       "2012-07-01_01:59:45", 1));
+    assert(check_matches("*/15 * 1-4 * * *",       "2012-07-01_01:59:46", 0));
+    assert(check_matches("*/15 * 1-4 * * *",       "2012-07-01_05:00:00", 0));
+    assert(check_matches("0 0 7 ? * MON-FRI",      "2009-09-28_07:00:00", 1));
+    assert(check_matches("0 0 7 ? * MON-FRI",      "2009-09-27_07:00:00", 0));
+    assert(check_matches("0 30 23 30 1/3 ?",       "2011-07-30_23:30:00", 1));
+    assert(check_matches("0 30 23 30 1/3 ?",       "2011-06-30_23:30:00", 0));
+    assert(check_matches("0 0 0 29 2 ?",           "2012-02-29_00:00:00", 1));
+    assert(check_matches("0 0 0 L * ?",            "2100-02-28_00:00:00", 1));
+    assert(check_matches("0 0 0 L * ?",            "2000-02-28_00:00:00", 0));
+    assert(check_matches("0 0 1 L-3 * ?",          "2020-02-26_01:00:00", 1));
+    assert(check_matches("0 0 1 L-3 * ?",          "2020-02-25_01:00:00", 0));
+    assert(check_matches("0 0 1 LW * ?",           "2022-07-29_01:00:00", 1));
+    assert(check_matches("0 0 1 LW * ?",           "2022-07-31_01:00:00", 0));
+    assert(check_matches("0 0 1 ? * 5L",           "2022-06-24_01:00:00", 1));
+    assert(check_matches("0 0 1 ? * 5L",           "2022-06-17_01:00:00", 0));
+    assert(check_matches("0 0 0 15W * ?",          "2022-05-16_00:00:00", 1));
+    assert(check_matches("0 0 0 15W * ?",          "2022-05-15_00:00:00", 0));
+    assert(check_matches("0 0 0 1W * ?",           "2022-10-03_00:00:00", 1));
+    assert(check_matches("0 0 0 1W,15W,LW * *",    "2023-04-28_00:00:00", 1));
+}
+
+/* Dates in UTC; Central European Time switches at 01:00 UTC on the last Sundays of March and October */
+void check_zone(const cron_zone *zone) {
+    assert(3600 == cron_zone_offset(zone, 1672531200)); /* 2023-01-01_00:00:00 */
+    assert(7200 == cron_zone_offset(zone, 1688169600)); /* 2023-07-01_00:00:00 */
+    assert(check_next_tz(zone, "0 0 12 * * *",          "2023-07-01_00:00:00", "2023-07-01_10:00:00"));
+    assert(check_next_tz(zone, "0 0 12 * * *",          "2023-01-01_00:00:00", "2023-01-01_11:00:00"));
+    assert(check_next_tz(zone, "0 0 7 ? * MON-FRI",     "2023-03-24_12:00:00", "2023-03-27_05:00:00"));
+    /* Skipped wall-clock time fires at the transition */
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-03-25_02:00:00", "2023-03-26_01:00:00"));
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-03-26_00:59:59", "2023-03-26_01:00:00"));
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-03-26_01:00:00", "2023-03-27_00:30:00"));
+    assert(check_next_tz(zone, "0 */20 * * * *",        "2023-03-26_00:50:00", "2023-03-26_01:00:00"));
+    assert(check_next_tz(zone, "0 */20 * * * *",        "2023-03-26_01:00:00", "2023-03-26_01:20:00"));
+    /* Repeated wall-clock time fires at its first occurrence only */
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-10-28_12:00:00", "2023-10-29_00:30:00"));
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-10-29_00:30:00", "2023-10-30_01:30:00"));
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-10-29_01:15:00", "2023-10-30_01:30:00"));
+    assert(check_next_tz(zone, "0 30 2 * * *",          "2023-10-29_00:59:59", "2023-10-30_01:30:00"));
+    assert(check_next_tz(zone, "0 0 * * * *",           "2023-10-29_00:00:00", "2023-10-29_02:00:00"));
+    assert(check_next_tz(zone, "0 0 * * * *",           "2023-10-29_00:59:59", "2023-10-29_02:00:00"));
+    assert(check_next_tz(zone, "0 0 3 L * ?",           "2023-10-29_00:00:00", "2023-10-31_02:00:00"));
+}
+
+void test_zone() {
+    uint8_t buf[256];
+    const char *err = NULL;
+    cron_zone *zone = cron_zone_parse(buf, make_tzif(buf, 3600, "CET-1CEST,M3.5.0,M10.5.0/3"), &err);
+    assert(zone && !err);
+    check_zone(zone);
+    cron_zone_free(zone);
+
+    zone = cron_zone_load("/usr/share/zoneinfo/Europe/Berlin", &err);
+    if (zone) {
+        check_zone(zone);
+        cron_zone_free(zone);
+    }
+
+    zone = cron_zone_parse(buf, make_tzif(buf, 19800, "IST-5:30"), &err);
+    assert(zone && !err);
+    assert(19800 == cron_zone_offset(zone, 1688169600));
+    assert(check_next_tz(zone, "0 0 12 * * *",          "2023-07-01_00:00:00", "2023-07-01_06:30:00"));
+    cron_zone_free(zone);
+
+    assert(!cron_zone_parse(buf, make_tzif(buf, 3600, "CET-1CEST,M3.5.0"), &err) && err);
+    assert(!cron_zone_parse(buf, 20, &err) && err);
+    assert(!cron_zone_load("/nonexistent/zone", &err) && err);
+}
+
+void test_table() {
+    static const char *patterns[] = {
+            "* * * * * *", "0 * * * * *", "*/15 * 1-4 * * *", "0 0 7 ? * MON-FRI", "0 30 23 30 1/3 ?",
+            "0 0 0 L * ?", "0 0 0 L-3 * ?", "0 0 0 L-30 * ?", "0 0 0 LW * ?", "0 0 0 1W,15W,31W * ?",
+            "0 0 0 ? * 5L", "0 0 0 ? * L-2", "0 0 0 1,L,L-9,31W * ?", "0 0 0 29 2 ?", "0 0 12 13 * ?"
+    };
+    static const char *dates[] = {
+            "2012-07-01_00:00:00", "2012-07-02_01:15:00", "2011-07-30_23:30:00", "2009-09-28_07:00:00",
+            "2023-12-29_00:00:00", "2023-12-31_00:00:00", "2024-02-29_00:00:00", "2022-06-24_00:00:00",
+            "2025-01-01_00:00:00", "2023-02-01_00:00:00", "2023-04-28_00:00:00", "2023-02-13_12:00:00"
+    };
+    cron_expr exprs[ARRAY_LEN(patterns) * 20];
+    uint64_t bitmap[(ARRAY_LEN(exprs) + 63) / 64];
+    const char *err = NULL;
+    size_t i, j, count;
+    /* Spread the patterns over several bitmap words */
+    for (i = 0; i < ARRAY_LEN(exprs); i++) {
+        cron_parse_expr(patterns[i % ARRAY_LEN(patterns)], &exprs[i], &err);
+        assert(!err);
+    }
+    cron_table *table = cron_table_create(exprs, ARRAY_LEN(exprs));
+    assert(table && ARRAY_LEN(exprs) == cron_table_count(table));
+    for (j = 0; j < ARRAY_LEN(dates); j++) {
+        struct tm *caldate = poors_mans_strptime(dates[j]);
+        time_t date = timegm(caldate);
+        free(caldate);
+        count = cron_table_match(table, date, bitmap);
+        for (i = 0; i < ARRAY_LEN(exprs); i++) {
+            int matches = (int) (bitmap[i / 64] >> (i % 64) & 1);
+            if (matches != cron_matches(&exprs[i], date)) {
+                printf("Pattern: %s\nDate: %s\nTable match: %d\n", patterns[i % ARRAY_LEN(patterns)], dates[j],
+                       matches);
+                assert(0);
+            }
+            count -= (size_t) matches;
+        }
+        assert(0 == count);
+    }
+    cron_table_free(table);
+}
+
+/* Bump allocator counting its live blocks, reset at once */
+typedef struct {
+    uint64_t mem[4096];
+    size_t used;
+    int live;
+} test_arena;
+
+static void *test_arena_alloc(void *ctx, size_t size) {
+    test_arena *arena = (test_arena *) ctx;
+    size_t words = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    void *p;
+    if (words > ARRAY_LEN(arena->mem) - arena->used) return NULL;
+    p = arena->mem + arena->used;
+    arena->used += words;
+    arena->live++;
+    return p;
+}
+
+static void test_arena_free(void *ctx, void *ptr) {
+    test_arena *arena = (test_arena *) ctx;
+    assert(ptr >= (void *) arena->mem && ptr < (void *) (arena->mem + arena->used));
+    arena->live--;
+}
+
+void test_allocator() {
+    static test_arena arena;
+    cron_allocator allocator = {test_arena_alloc, test_arena_free, &arena};
+    uint8_t buf[256];
+    cron_expr exprs[3];
+    const char *err = NULL;
+    size_t i;
+    cron_table *table;
+    cron_zone *zone;
+    for (i = 0; i < ARRAY_LEN(exprs); i++) {
+        cron_parse_expr("0 0 0 L-30 * ?", &exprs[i], &err);
+        assert(!err);
+    }
+
+    table = cron_table_create_ex(exprs, ARRAY_LEN(exprs), &allocator);
+    assert(table && 1 == arena.live && arena.used > 0);
+    assert(ARRAY_LEN(exprs) == cron_table_count(table));
+    cron_table_free(table);
+    assert(0 == arena.live);
+
+    zone = cron_zone_parse_ex(buf, make_tzif(buf, 19800, "IST-5:30"), &allocator, &err);
+    assert(zone && !err && 1 == arena.live);
+    assert(19800 == cron_zone_offset(zone, 1688169600));
+    cron_zone_free(zone);
+    assert(!cron_zone_parse_ex(buf, 20, &allocator, &err) && err);
+    assert(0 == arena.live);
+
+    /* Objects are freed with the allocator they were created with */
+    cron_set_allocator(&allocator);
+    table = cron_table_create(exprs, ARRAY_LEN(exprs));
+    cron_set_allocator(NULL);
+    assert(table && 1 == arena.live);
+    cron_table_free(table);
+    assert(0 == arena.live);
+
+    /* Out of arena memory */
+    arena.used = ARRAY_LEN(arena.mem);
+    assert(!cron_table_create_ex(exprs, ARRAY_LEN(exprs), &allocator));
+    arena.used = 0;
+    table = cron_table_create_ex(exprs, ARRAY_LEN(exprs), NULL);
+    assert(table && 0 == arena.used);
+    cron_table_free(table);
+}
+
+void test_batch() {
+    static const char *patterns[] = {
+            "* * * * * *", "0 * * * * *", "*/15 * 1-4 * * *", "0 0 7 ? * MON-FRI", "0 30 23 30 1/3 ?",
+            "0 0 0 L * ?", "0 0 0 LW * ?", "0 0 0 ? * 5L", "0 0 0 29 2 ?", "0 0 12 13 * ?"
+    };
+    static const unsigned int threads[] = { 1, 3, 0, 1000 };
+    cron_expr exprs[ARRAY_LEN(patterns) * 100];
+    time_t out[ARRAY_LEN(exprs)];
+    const char *err = NULL;
+    time_t date = 1341100430; /* 2012-07-01_00:00:30 */
+    size_t i, j;
+    for (i = 0; i < ARRAY_LEN(exprs); i++) {
+        cron_parse_expr(patterns[i % ARRAY_LEN(patterns)], &exprs[i], &err);
+        assert(!err);
+    }
+    for (j = 0; j < ARRAY_LEN(threads); j++) {
+        memset(out, 0, sizeof(out));
+        cron_next_batch(exprs, ARRAY_LEN(exprs), date, out, threads[j]);
+        for (i = 0; i < ARRAY_LEN(exprs); i++) {
+            if (out[i] != cron_next(&exprs[i], date)) {
+                printf("Pattern: %s\nThreads: %u\nBatch: %ld\n", patterns[i % ARRAY_LEN(patterns)], threads[j],
+                       (long) out[i]);
+                assert(0);
+            }
+        }
+    }
+}
+
+void test_fill_range() {
+    assert(check_fill_range("*/5 * * * * *",         "2012-07-01_09:53:50", "2012-07-03_00:00:00", 100000));
+    assert(check_fill_range("*/5 * * * * *",         "2012-07-01_09:53:50", "2012-07-03_00:00:00", 1000));
+    assert(check_fill_range("*/15 * 1-4 * * *",      "2012-07-01_09:53:50", "2012-07-05_02:30:00", 10000));
+    assert(check_fill_range("0 0 7 ? * MON-FRI",     "2009-09-26_00:42:55", "2010-09-26_00:00:00", 1000));
+    assert(check_fill_range("0 30 23 30 1/3 ?",      "2011-04-30_23:30:00", "2014-01-01_00:00:00", 100));
+    assert(check_fill_range("0 0 1 LW,L-3 * ?",      "2022-07-30_00:00:00", "2024-01-01_00:00:00", 100));
+    assert(check_fill_range("0 0 0 1W,15W,LW * *",   "2023-02-16_01:02:03", "2024-03-01_00:00:00", 100));
+    assert(check_fill_range("0 0 1 ? * 5L",          "2022-06-25_00:00:00", "2023-06-25_00:00:00", 100));
+    assert(check_fill_range("0 0 0 29 2 ?",          "2012-01-01_00:00:00", "2030-01-01_00:00:00", 100));
+    assert(check_fill_range("0 0 0 29 2 ?",          "2012-02-29_00:00:00", "2012-02-29_00:00:00", 100));
+    assert(check_fill_range("* * * * * *",           "2012-12-31_23:59:50", "2013-01-01_00:00:10", 5));
+    {
+        // December of the year -1, year * 12 + month -1
+        const time_t dec15 = (time_t) INT64_C(-62168688000);
+        const time_t jan1 = (time_t) INT64_C(-62167176000); /* year 0, 12:00 */
+        time_t out[8];
+        cron_expr parsed;
+        const char *err = NULL;
+        cron_parse_expr("0 0 12 1-20 * ?", &parsed, &err);
+        assert(7 == cron_fill_range(&parsed, dec15, jan1, out, 8));
+        assert(dec15 + 43200 == out[0] && jan1 == out[6]);
+        assert(dec15 + 5 * 86400 + 43200 == cron_prev(&parsed, jan1 - 1));
+    }
+}
+
+void test_count() {
+    assert(check_count("*/5 * * * * *",          "2012-07-01_09:53:50", "2012-07-03_00:00:00"));
+    assert(check_count("*/15 * 1-4 * * *",       "2012-07-01_09:53:50", "2012-07-05_02:30:00"));
+    assert(check_count("*/15 * 1-4 * * *",       "2012-07-01_02:30:00", "2012-07-01_02:30:00"));
+    assert(check_count("*/15 * 1-4 * * *",       "2012-07-01_02:30:00", "2012-07-01_02:30:15"));
+    assert(check_count("0 0 7 ? * MON-FRI",      "2009-09-26_00:42:55", "2012-09-26_00:00:00"));
+    assert(check_count("0 30 23 30 1/3 ?",       "2011-04-30_23:30:00", "2014-01-01_00:00:00"));
+    assert(check_count("0 0 1 LW,L-3 * ?",       "2022-07-30_00:00:00", "2024-01-01_01:00:00"));
+    assert(check_count("0 0 0 1W,15W,LW * *",    "2023-02-16_01:02:03", "2024-03-01_00:00:00"));
+    assert(check_count("0 0 1 ? * 5L",           "2022-06-25_00:00:00", "2023-06-25_00:00:00"));
+    assert(check_count("0 0 0 29 2 ?",           "2012-01-01_00:00:00", "2030-01-01_00:00:00"));
+    assert(check_count("0 0 0 ? * SAT,SUN",      "2012-12-31_23:59:59", "2013-12-31_23:59:59"));
+
+    assert(check_nth("*/5 * * * * *",            "2012-07-01_09:53:50", 1));
+    assert(check_nth("*/5 * * * * *",            "2012-07-01_09:53:50", 100000));
+    assert(check_nth("*/15 * 1-4 * * *",         "2012-07-01_09:53:50", 3000));
+    assert(check_nth("0 0 7 ? * MON-FRI",        "2009-09-26_00:42:55", 600));
+    assert(check_nth("0 30 23 30 1/3 ?",         "2011-04-30_23:30:00", 7));
+    assert(check_nth("0 0 1 LW,L-3 * ?",         "2022-07-30_00:00:00", 25));
+    assert(check_nth("0 0 0 1W,15W,LW * *",      "2023-02-16_01:02:03", 40));
+    assert(check_nth("0 0 1 ? * 5L",             "2022-06-25_00:00:00", 12));
+    assert(check_nth("0 0 0 29 2 ?",             "2012-02-29_00:00:00", 2));
+    assert(check_nth("0 0 0 31 6 *",             "2012-07-01_09:53:50", 1));
 }
 
 void test_parse() {
@@ -664,6 +1629,12 @@ void test_parse() {
     assert(check_expr_invalid("0 0 0 H * SUN"));
     assert(check_expr_invalid("0 0 0 2 * H"));
     assert(check_expr_invalid("0 0 0 2W * H"));
+    assert(check_expr_invalid("0 */0 * * * *"));
+    assert(check_expr_invalid("0 0 0 40W * ?"));
+    assert(check_expr_invalid("+5 * * * * *"));
+    assert(check_expr_invalid("0 1--5 * * * *"));
+    assert(check_expr_invalid("0 0 0 W * ?"));
+    assert(check_expr_invalid("1H * * * * *"));
 }
 
 void test_bits() {
@@ -791,23 +1762,125 @@ void test_invalid_bits(void) {
 void test_memory() {
     cron_expr cron;
     const char *err;
+    int total = cronTotalAllocations;
 
     cron_parse_expr("* * * * * *", &cron, &err);
     if (cronAllocations != 0) {
         printf("Allocations != 0 but %d\n", cronAllocations);
         assert(cronAllocations == 0);
     }
+    /* Parsing works on stack buffers only */
+    cron_parse_expr("H/5 0,30 H(8-18) L-2,1W,LW * ?", &cron, &err);
+    assert(err == NULL);
+    cron_parse_expr("0 0 12 ? JAN-MAR,DEC 1L,FRI", &cron, &err);
+    assert(err == NULL);
+    cron_parse_expr("0 0 12 ? * 1,L", &cron, &err);
+    assert(err == NULL);
+    cron_parse_expr("0 0 12 * * MON-", &cron, &err);
+    assert(err != NULL);
+    assert(cronTotalAllocations == total);
     printf("Allocations: total: %d, max: %d\n", cronTotalAllocations, maxAlloc);
 }
 
 #endif
 
+#ifdef CRON_USE_LOCAL_TIME
+
+/* Central European Time, switching at 01:00 UTC on the last Sundays of March and October */
+#define TEST_CET_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
+
+/** Set the TZ of the process, unset it for NULL */
+void set_tz(const char *tz) {
+    if (tz) {
+        setenv("TZ", tz, 1);
+    } else {
+        unsetenv("TZ");
+    }
+    tzset();
+}
+
+/** Repeated wall-clock time resolved without a zone snapshot, after conversions in summer and winter time */
+void test_local_fold() {
+    const char *err = NULL;
+    cron_expr parsed, other;
+    cron_parse_expr("0 30 2 ? * SUN", &parsed, &err);
+    assert(!err);
+    cron_parse_expr("0 0 12 * * *", &other, &err);
+    assert(!err);
+    set_tz(TEST_CET_TZ);
+    assert(1698539400 == cron_next(&parsed, 1698537600)); /* 2023-10-29_00:00:00 -> 00:30:00, CEST */
+    assert(1698543000 == cron_next(&parsed, 1698542100)); /* 2023-10-29_01:15:00 -> 01:30:00, CET */
+    cron_next(&other, 1688169600); /* 2023-07-01_00:00:00 */
+    assert(1698539400 == cron_next(&parsed, 1698537600));
+    assert(1698543000 == cron_next(&parsed, 1698542100));
+    cron_next(&other, 1672531200); /* 2023-01-01_00:00:00 */
+    assert(1698539400 == cron_next(&parsed, 1698537600));
+    assert(1698543000 == cron_next(&parsed, 1698542100));
+    set_tz("UTC"); /* zone of the other tests */
+}
+
+/** Wall-clock times skipped by a forward transition match at the transition and repeated ones at their first
+ * occurrence only, where the zone snapshot fires them */
+void test_local_gap() {
+    const char *err = NULL;
+    cron_expr parsed;
+    time_t dates[3] = {1679792399, 1679792400, 1679792401}; /* 2023-03-26_00:59:59 to 01:00:01 */
+    uint8_t matches[3];
+    set_tz(TEST_CET_TZ);
+    assert(0 == cron_local_zone_refresh());
+    assert(check_matches("0 30 2 * * *",            "2023-03-26_01:00:00", 1));
+    assert(check_matches("0 30 2 * * *",            "2023-03-26_01:00:01", 0));
+    assert(check_matches("0 */20 2 * * *",          "2023-03-26_01:00:00", 1));
+    assert(check_matches("0 30 1 * * *",            "2023-03-26_01:00:00", 0));
+    assert(check_matches("0 30 2 * * *",            "2023-10-29_01:00:00", 0));
+    assert(check_matches("0 30 2 * * *",            "2023-10-29_00:30:00", 1));
+    assert(check_matches("0 30 2 * * *",            "2023-10-29_01:30:00", 0)); /* repeated wall-clock time */
+    assert(check_matches("0 0 3 * * *",             "2023-03-26_01:00:00", 1));
+    cron_parse_expr("0 30 2 * * *", &parsed, &err);
+    assert(!err);
+    assert(1 == cron_stream_match(&parsed, dates, 3, matches, NULL));
+    assert(0 == matches[0] && 1 == matches[1] && 0 == matches[2]);
+    cron_local_zone_clear();
+    set_tz("UTC"); /* zone of the other tests */
+}
+
+#endif /* CRON_USE_LOCAL_TIME */
+
 int main() {
 
     test_bits();
 
     test_expr();
+    test_prev();
+    test_limits();
+    test_matches();
+    test_table();
+    test_allocator();
+    test_batch();
+    test_fill_range();
+    test_count();
+    test_zone();
     test_parse();
+    test_parse_cache();
+    test_parse_lines();
+    test_crontab();
+    test_satisfiable();
+    test_classify();
+    test_cursor();
+    test_due();
+    test_stream_match();
+#ifdef CRON_USE_LOCAL_TIME
+    /* Same results from a snapshot of the time zone, run with TZ=UTC like the other tests in this mode */
+    assert(0 == cron_local_zone_refresh());
+    test_expr();
+    test_prev();
+    test_limits();
+    test_matches();
+    test_batch();
+    cron_local_zone_clear();
+    test_local_fold();
+    test_local_gap();
+#endif
     check_calc_invalid();
     test_invalid_bits();
 #ifdef CRON_TEST_MALLOC